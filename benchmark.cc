@@ -0,0 +1,517 @@
+// Benchmark.cc
+//
+// Times the public operations of Datastructures on synthetic networks of
+// growing size and fits how the time per call grows, so the "Estimate of
+// performance" comments in datastructures.hh can be checked against
+// measurements. The estimates are read from the header itself, and every
+// operation that has one must be timed here.
+//
+// usage: datastructures_benchmark [--seed N] [--sizes 1000,10000,...] [--calls N] [--header PATH]
+
+#include "datastructures.hh"
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <random>
+#include <sstream>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#ifndef DATASTRUCTURES_HEADER
+#define DATASTRUCTURES_HEADER "datastructures.hh"
+#endif
+
+namespace
+{
+// Complexity classes the fit chooses from
+struct Complexity{
+    char const* name;
+    double (*grow)(double n);
+};
+Complexity const CLASSES[] = {
+    {"1", [](double){ return 1.0; }},
+    {"log n", [](double n){ return std::log2(n); }},
+    {"n", [](double n){ return n; }},
+    {"n log n", [](double n){ return n * std::log2(n); }},
+    {"n^2", [](double n){ return n * n; }},
+};
+// Whole network operations run once, route searches a limited number of times
+unsigned int const ALL = 0;
+unsigned int const ONCE = 1;
+unsigned int const SEARCHES = 50;
+// Timings are noisy and caches get colder as n grows, so a slope this much
+// above the estimate is tolerated before an operation is flagged
+double const SLOPE_TOLERANCE = 0.35;
+unsigned int const QUERY_ROUNDS = 5;
+
+// In the generated network every count named by one of these letters is
+// proportional to the station count n, and the region tree height h grows with
+// log n. Every other letter of an estimate is a per call amount, such as k
+// results or a batch of calls, which the benchmark keeps the same for all sizes.
+char const* const GROWS_WITH_N = "nVECDSRTe";
+double const PER_CALL_AMOUNT = 8.0;
+
+/**
+ * @brief Growth evaluates the text inside O(...) of an estimate for a network of n stations:
+ *   sum := product (('+' | '-') product)*
+ *   product := power (('*' | '/')? power)*, adjacent factors multiply
+ *   power := atom ('^' atom)?
+ *   atom := number | name | 'log' atom | '(' sum ')'
+ */
+class Growth{
+public:
+    Growth(std::string const& text, double n) : text(text), n(n){}
+    // NaN when the text does not parse
+    double value()
+    {
+        double v = sum();
+        skip_spaces();
+        return ok && at == text.size() ? v : std::numeric_limits<double>::quiet_NaN();
+    }
+
+private:
+    std::string const& text;
+    double n;
+    std::size_t at = 0;
+    bool ok = true;
+
+    static double log_of(double x){ return std::log2(std::max(2.0, x)); }
+    void skip_spaces(){ while(at < text.size() && text[at] == ' '){++at;} }
+    char peek(){ skip_spaces(); return at < text.size() ? text[at] : '\0'; }
+    double sum()
+    {
+        double v = product();
+        for(char c = peek(); c == '+' || c == '-'; c = peek()){
+            ++at;
+            v = c == '+' ? v + product() : v - product();
+        }
+        return v;
+    }
+    double product()
+    {
+        double v = power();
+        for(char c = peek(); c == '*' || c == '/' || c == '(' || std::isalnum(static_cast<unsigned char>(c)); c = peek()){
+            if(c == '*' || c == '/'){++at;}
+            v = c == '/' ? v / power() : v * power();
+        }
+        return v;
+    }
+    double power()
+    {
+        double v = atom();
+        if(peek() == '^'){
+            ++at;
+            v = std::pow(v, atom());
+        }
+        return v;
+    }
+    double atom()
+    {
+        char c = peek();
+        if(c == '('){
+            ++at;
+            double v = sum();
+            if(peek() != ')'){ok = false;}
+            ++at;
+            return v;
+        }
+        if(std::isdigit(static_cast<unsigned char>(c))){
+            std::size_t end = at;
+            double v = std::stod(text.substr(at), &end);
+            at += end;
+            return v;
+        }
+        std::size_t begin = at;
+        while(at < text.size() && (std::isalnum(static_cast<unsigned char>(text[at])) || text[at] == '_')){++at;}
+        std::string name = text.substr(begin, at - begin);
+        if(name.empty()){
+            ok = false;
+            return 0;
+        }
+        // "log n" and "logn" are both written
+        if(name.compare(0, 3, "log") == 0){
+            at = begin + 3;
+            return log_of(atom());
+        }
+        if(name.size() == 1 && std::strchr(GROWS_WITH_N, name[0]) != nullptr){return n;}
+        if(name == "h"){return log_of(n);}
+        return PER_CALL_AMOUNT;
+    }
+};
+
+/**
+ * @brief read_estimates collects the "Estimate of performance: O(...)" comments of the
+ * Datastructures class. The second declaration of an overloaded name is keyed name/2.
+ * @return the text inside O(...) for every operation, empty if the header cannot be read
+ */
+std::map<std::string, std::string> read_estimates(std::string const& path)
+{
+    std::map<std::string, std::string> estimates;
+    std::ifstream header(path);
+    std::string line;
+    while(std::getline(header, line) && line.compare(0, 20, "class Datastructures") != 0){}
+
+    std::string pending;
+    std::map<std::string, unsigned int> declared;
+    while(std::getline(header, line) && line != "};"){
+        auto marker = line.find("Estimate of performance: O(");
+        if(marker != std::string::npos){
+            std::size_t begin = marker + 27;
+            std::size_t end = begin;
+            for(int depth = 1; end < line.size(); ++end){
+                if(line[end] == '('){++depth;}
+                if(line[end] == ')' && --depth == 0){break;}
+            }
+            pending = line.substr(begin, end - begin);
+            continue;
+        }
+        auto first = line.find_first_not_of(' ');
+        auto paren = line.find('(');
+        if(pending.empty() || first == std::string::npos || line.compare(first, 2, "//") == 0 || paren == std::string::npos){continue;}
+        auto name_end = paren;
+        auto name_begin = line.find_last_of(" *&:", name_end - 1) + 1;
+        std::string name = line.substr(name_begin, name_end - name_begin);
+        unsigned int count = ++declared[name];
+        estimates[count == 1 ? name : name + "/" + std::to_string(count)] = pending;
+        pending.clear();
+    }
+    return estimates;
+}
+
+/**
+ * @brief log_slope least squares slope of log value against log n
+ */
+double log_slope(std::vector<unsigned int> const& sizes, std::vector<double> const& values)
+{
+    double mx = 0, my = 0;
+    for(std::size_t i = 0; i < sizes.size(); ++i){
+        mx += std::log(double(sizes[i]));
+        my += std::log(std::max(values[i], 1e-3));
+    }
+    mx /= sizes.size();
+    my /= sizes.size();
+    double sxy = 0, sxx = 0;
+    for(std::size_t i = 0; i < sizes.size(); ++i){
+        double dx = std::log(double(sizes[i])) - mx;
+        sxy += dx * (std::log(std::max(values[i], 1e-3)) - my);
+        sxx += dx * dx;
+    }
+    return sxx > 0 ? sxy / sxx : 0.0;
+}
+
+// Query arguments drawn before the clock starts, entry i is used by call i
+struct Inputs{
+    std::vector<StationID> stations;
+    std::vector<StationID> other_stations;
+    std::vector<StationID> new_stations;
+    std::vector<Coord> coords;
+    std::vector<RegionID> regions;
+    std::vector<RegionID> other_regions;
+    std::vector<RegionID> new_regions;
+    std::vector<TrainID> trains;
+    std::vector<TrainID> new_trains;
+    std::vector<Time> times;
+    std::string station_csv;
+    std::string departure_csv;
+    std::string train_csv;
+
+    Inputs(unsigned int seed, unsigned int n, unsigned int calls)
+    {
+        std::minstd_rand rng(seed);
+        int side = static_cast<int>(1000.0 * std::sqrt(double(n)));
+        RegionID region_count = std::max(1u, n / 100);
+        unsigned int line_count = std::max(1u, n / 10);
+        for(unsigned int i = 0; i < calls; ++i){
+            stations.push_back("S" + std::to_string(rng() % n));
+            other_stations.push_back("S" + std::to_string(rng() % n));
+            new_stations.push_back("B" + std::to_string(i));
+            coords.push_back(Coord{static_cast<int>(rng() % (side + 1)), static_cast<int>(rng() % (side + 1))});
+            regions.push_back(1 + rng() % region_count);
+            other_regions.push_back(1 + rng() % region_count);
+            new_regions.push_back(region_count + 1 + i);
+            trains.push_back("T" + std::to_string(rng() % line_count) + "_" + std::to_string(rng() % 4));
+            new_trains.push_back("X" + std::to_string(i));
+            times.push_back(static_cast<Time>(rng() % 700));
+        }
+        std::ostringstream station_text, departure_text, train_text;
+        for(unsigned int i = 0; i < calls; ++i){
+            station_text << "I" << i << ",Ingested," << coords[i].x << "," << coords[i].y << "\n";
+            departure_text << stations[i] << ",D" << i % 7 << "," << times[i] << "\n";
+            train_text << "Y" << i << "," << stations[i] << ",100," << other_stations[i] << ",110\n";
+        }
+        station_csv = station_text.str();
+        departure_csv = departure_text.str();
+        train_csv = train_text.str();
+    }
+};
+
+// An operation is called --calls times per size, at most max_calls times when
+// that is set. Queries do not change the network, so their calls are repeated
+// and the fastest round counts. The body returns something derived from the
+// result so it is not optimised away. The name is the key of its estimate.
+struct Operation{
+    std::string name;
+    unsigned int max_calls;
+    bool query;
+    std::function<std::size_t(Datastructures&, Inputs const&, unsigned int)> body;
+};
+
+std::vector<Operation> operations()
+{
+    using D = Datastructures;
+    using I = Inputs;
+    // Queries first, then operations that add to the network, destructive ones last
+    return {
+        {"station_count", ALL, true, [](D& ds, I const&, unsigned int){ return ds.station_count(); }},
+        {"get_station_name", ALL, true, [](D& ds, I const& in, unsigned int i){ return ds.get_station_name(in.stations[i]).size(); }},
+        {"get_station_coordinates", ALL, true, [](D& ds, I const& in, unsigned int i){ return std::size_t(ds.get_station_coordinates(in.stations[i]).x); }},
+        {"all_stations", ONCE, true, [](D& ds, I const&, unsigned int){ return ds.all_stations().size(); }},
+        {"stations_alphabetically", ONCE, true, [](D& ds, I const&, unsigned int){ return ds.stations_alphabetically().size(); }},
+        {"stations_alphabetically/2", ALL, true, [](D& ds, I const& in, unsigned int i){
+             return ds.stations_alphabetically(ds.get_station_name(in.stations[i]), 20, in.stations[i]).size(); }},
+        {"stations_with_prefix", ALL, true, [](D& ds, I const& in, unsigned int i){ return ds.stations_with_prefix(ds.get_station_name(in.stations[i]).substr(0, 3), 10).size(); }},
+        {"for_each_station_alphabetically", ALL, true, [](D& ds, I const&, unsigned int i){
+             return ds.for_each_station_alphabetically([](std::string_view id){ return !id.empty(); }, i % 16, 20); }},
+        {"for_each_station", ALL, true, [](D& ds, I const&, unsigned int i){
+             return ds.for_each_station([](std::string_view id){ return !id.empty(); }, i % 16, 20); }},
+        {"for_each_station_by_distance", ALL, true, [](D& ds, I const&, unsigned int i){
+             return ds.for_each_station_by_distance([](std::string_view id){ return !id.empty(); }, i % 16, 20); }},
+        {"stations_distance_increasing", ONCE, true, [](D& ds, I const&, unsigned int){ return ds.stations_distance_increasing().size(); }},
+        {"find_station_with_coord", ALL, true, [](D& ds, I const& in, unsigned int i){ return ds.find_station_with_coord(in.coords[i]).size(); }},
+        {"station_departures_after", ALL, true, [](D& ds, I const& in, unsigned int i){ return ds.station_departures_after(in.stations[i], in.times[i]).size(); }},
+        {"station_departures_after/2", ALL, true, [](D& ds, I const& in, unsigned int i){ return ds.station_departures_after(in.stations[i], in.times[i], 5).size(); }},
+        {"all_regions", ONCE, true, [](D& ds, I const&, unsigned int){ return ds.all_regions().size(); }},
+        {"for_each_region", ALL, true, [](D& ds, I const&, unsigned int i){
+             // The smallest network has 10 regions, so every size visits the same number
+             return ds.for_each_region([](RegionID id){ return id != NO_REGION; }, i % 4, 5); }},
+        {"get_region_name", ALL, true, [](D& ds, I const& in, unsigned int i){ return ds.get_region_name(in.regions[i]).size(); }},
+        {"get_region_coords", ALL, true, [](D& ds, I const& in, unsigned int i){ return ds.get_region_coords(in.regions[i]).size(); }},
+        {"station_in_regions", ALL, true, [](D& ds, I const& in, unsigned int i){ return ds.station_in_regions(in.stations[i]).size(); }},
+        {"all_subregions_of_region", ALL, true, [](D& ds, I const& in, unsigned int i){ return ds.all_subregions_of_region(in.regions[i]).size(); }},
+        {"common_parent_of_regions", ALL, true, [](D& ds, I const& in, unsigned int i){ return std::size_t(ds.common_parent_of_regions(in.regions[i], in.other_regions[i])); }},
+        {"is_subregion_of", ALL, true, [](D& ds, I const& in, unsigned int i){ return std::size_t(ds.is_subregion_of(in.regions[i], in.other_regions[i])); }},
+        {"regions_containing", ALL, true, [](D& ds, I const& in, unsigned int i){ return ds.regions_containing(in.coords[i]).size(); }},
+        {"stations_closest_to", ALL, true, [](D& ds, I const& in, unsigned int i){ return ds.stations_closest_to(in.coords[i]).size(); }},
+        {"stations_nearest", ALL, true, [](D& ds, I const& in, unsigned int i){ return ds.stations_nearest(in.coords[i], 10).size(); }},
+        {"stations_within_radius", ALL, true, [](D& ds, I const& in, unsigned int i){ return ds.stations_within_radius(in.coords[i], 3000).size(); }},
+        {"next_stations_from", ALL, true, [](D& ds, I const& in, unsigned int i){ return ds.next_stations_from(in.stations[i]).size(); }},
+        {"for_each_next_station", ALL, true, [](D& ds, I const& in, unsigned int i){
+             return ds.for_each_next_station(in.stations[i], [](std::string_view id){ return !id.empty(); }); }},
+        {"train_stations_from", ALL, true, [](D& ds, I const& in, unsigned int i){ return ds.train_stations_from(in.stations[i], in.trains[i]).size(); }},
+        {"trains_through_station", ALL, true, [](D& ds, I const& in, unsigned int i){ return ds.trains_through_station(in.stations[i]).size(); }},
+        {"route_any", SEARCHES, true, [](D& ds, I const& in, unsigned int i){ return ds.route_any(in.stations[i], in.other_stations[i]).size(); }},
+        {"route_least_stations", SEARCHES, true, [](D& ds, I const& in, unsigned int i){ return ds.route_least_stations(in.stations[i], in.other_stations[i]).size(); }},
+        {"route_with_cycle", SEARCHES, true, [](D& ds, I const& in, unsigned int i){ return ds.route_with_cycle(in.stations[i]).size(); }},
+        {"route_shortest_distance", SEARCHES, true, [](D& ds, I const& in, unsigned int i){ return ds.route_shortest_distance(in.stations[i], in.other_stations[i]).size(); }},
+        {"route_earliest_arrival", SEARCHES, true, [](D& ds, I const& in, unsigned int i){ return ds.route_earliest_arrival(in.stations[i], in.other_stations[i], in.times[i]).size(); }},
+        {"route_pareto", SEARCHES, true, [](D& ds, I const& in, unsigned int i){ return ds.route_pareto(in.stations[i], in.other_stations[i], in.times[i], 3).size(); }},
+        {"route_many", ONCE, true, [](D& ds, I const& in, unsigned int){
+             std::vector<std::pair<StationID, StationID>> queries;
+             for(std::size_t i = 0; i < std::min<std::size_t>(SEARCHES, in.stations.size()); ++i){
+                 queries.push_back({in.stations[i], in.other_stations[i]});
+             }
+             return ds.route_many(queries).size(); }},
+        {"closest_many", ONCE, true, [](D& ds, I const& in, unsigned int){ return ds.closest_many(in.coords).size(); }},
+        {"metrics_snapshot", ONCE, true, [](D&, I const&, unsigned int){ return D::metrics_snapshot().size(); }},
+        {"publish", ONCE, false, [](D& ds, I const&, unsigned int){ return std::size_t(ds.publish()); }},
+        {"pin", ALL, false, [](D& ds, I const&, unsigned int){ return std::size_t(ds.pin()->version); }},
+        {"save_snapshot", ONCE, false, [](D& ds, I const&, unsigned int){ return std::size_t(ds.save_snapshot("datastructures_benchmark.snap")); }},
+        {"load_snapshot", ONCE, false, [](D& ds, I const&, unsigned int){
+             bool loaded = ds.load_snapshot("datastructures_benchmark.snap");
+             std::remove("datastructures_benchmark.snap");
+             return std::size_t(loaded); }},
+        {"add_station", ALL, false, [](D& ds, I const& in, unsigned int i){ return std::size_t(ds.add_station(in.new_stations[i], "Added", in.coords[i])); }},
+        {"change_station_coord", ALL, false, [](D& ds, I const& in, unsigned int i){ return std::size_t(ds.change_station_coord(in.new_stations[i], in.coords[in.coords.size() - 1 - i])); }},
+        {"add_departure", ALL, false, [](D& ds, I const& in, unsigned int i){ return std::size_t(ds.add_departure(in.stations[i], in.trains[i], in.times[i])); }},
+        {"remove_departure", ALL, false, [](D& ds, I const& in, unsigned int i){ return std::size_t(ds.remove_departure(in.stations[i], in.trains[i], in.times[i])); }},
+        {"add_region", ALL, false, [](D& ds, I const& in, unsigned int i){
+             Coord c = in.coords[i];
+             return std::size_t(ds.add_region(in.new_regions[i], "Added", {c, {c.x + 10, c.y}, {c.x, c.y + 10}})); }},
+        {"add_subregion_to_region", ALL, false, [](D& ds, I const& in, unsigned int i){ return std::size_t(ds.add_subregion_to_region(in.new_regions[i], in.regions[i])); }},
+        {"add_station_to_region", ALL, false, [](D& ds, I const& in, unsigned int i){ return std::size_t(ds.add_station_to_region(in.new_stations[i], in.regions[i])); }},
+        {"add_train", ALL, false, [](D& ds, I const& in, unsigned int i){
+             return std::size_t(ds.add_train(in.new_trains[i], {{in.stations[i], 100}, {in.other_stations[i], 110}})); }},
+        {"add_stations_bulk", ONCE, false, [](D& ds, I const& in, unsigned int){
+             std::vector<std::tuple<StationID, Name, Coord>> batch;
+             for(std::size_t i = 0; i < in.coords.size(); ++i){batch.emplace_back("C" + std::to_string(i), "Bulk", in.coords[i]);}
+             return std::size_t(ds.add_stations_bulk(std::move(batch))); }},
+        {"add_regions_bulk", ONCE, false, [](D& ds, I const& in, unsigned int){
+             std::vector<std::tuple<RegionID, Name, std::vector<Coord>>> batch;
+             for(std::size_t i = 0; i < in.coords.size(); ++i){
+                 Coord c = in.coords[i];
+                 batch.emplace_back(in.new_regions.back() + 1 + i, "Bulk", std::vector<Coord>{c, {c.x + 10, c.y}, {c.x, c.y + 10}});
+             }
+             return std::size_t(ds.add_regions_bulk(std::move(batch))); }},
+        {"add_trains_bulk", ONCE, false, [](D& ds, I const& in, unsigned int){
+             std::vector<std::pair<TrainID, std::vector<std::pair<StationID, Time>>>> batch;
+             for(std::size_t i = 0; i < in.stations.size(); ++i){
+                 batch.push_back({"Z" + std::to_string(i), {{in.stations[i], 100}, {in.other_stations[i], 110}}});
+             }
+             return std::size_t(ds.add_trains_bulk(std::move(batch))); }},
+        {"ingest_stations", ONCE, false, [](D& ds, I const& in, unsigned int){
+             std::istringstream input(in.station_csv);
+             return std::size_t(ds.ingest_stations(input)); }},
+        {"ingest_departures", ONCE, false, [](D& ds, I const& in, unsigned int){
+             std::istringstream input(in.departure_csv);
+             return std::size_t(ds.ingest_departures(input)); }},
+        {"ingest_trains", ONCE, false, [](D& ds, I const& in, unsigned int){
+             std::istringstream input(in.train_csv);
+             return std::size_t(ds.ingest_trains(input)); }},
+        {"assign_stations_to_regions_by_geometry", ONCE, false, [](D& ds, I const&, unsigned int){ return std::size_t(ds.assign_stations_to_regions_by_geometry()); }},
+        {"remove_station", ALL, false, [](D& ds, I const& in, unsigned int i){ return std::size_t(ds.remove_station(in.new_stations[i])); }},
+        {"clear_trains", ONCE, false, [](D& ds, I const&, unsigned int){ ds.clear_trains(); return std::size_t(0); }},
+        {"clear_all", ONCE, false, [](D& ds, I const&, unsigned int){ ds.clear_all(); return std::size_t(0); }},
+    };
+}
+
+/**
+ * @brief fit picks the complexity class that best explains the times, i.e. the one
+ * whose ratio time / growth varies least in log scale
+ * @return best class and the least squares slope of log time against log n
+ */
+std::pair<Complexity const*, double> fit(std::vector<unsigned int> const& sizes, std::vector<double> const& times)
+{
+    Complexity const* best = &CLASSES[0];
+    double best_spread = std::numeric_limits<double>::max();
+    for(auto const& c : CLASSES){
+        double mean = 0, square = 0;
+        for(std::size_t i = 0; i < sizes.size(); ++i){
+            double r = std::log(std::max(times[i], 1e-3) / c.grow(sizes[i]));
+            mean += r;
+            square += r * r;
+        }
+        mean /= sizes.size();
+        double spread = square / sizes.size() - mean * mean;
+        if(spread < best_spread){
+            best_spread = spread;
+            best = &c;
+        }
+    }
+    return {best, log_slope(sizes, times)};
+}
+
+std::vector<unsigned int> parse_sizes(char const* text)
+{
+    std::vector<unsigned int> sizes;
+    std::istringstream input(text);
+    std::string item;
+    while(std::getline(input, item, ',')){
+        unsigned long size = std::strtoul(item.c_str(), nullptr, 10);
+        if(size > 0){sizes.push_back(static_cast<unsigned int>(size));}
+    }
+    return sizes;
+}
+}
+
+int main(int argc, char* argv[])
+{
+    unsigned int seed = 1;
+    unsigned int calls = 1000;
+    std::vector<unsigned int> sizes = {1000, 10000, 100000};
+    std::string header = DATASTRUCTURES_HEADER;
+    for(int a = 1; a + 1 < argc; a += 2){
+        if(std::strcmp(argv[a], "--seed") == 0){seed = static_cast<unsigned int>(std::strtoul(argv[a + 1], nullptr, 10));}
+        else if(std::strcmp(argv[a], "--calls") == 0){calls = std::max(1ul, std::strtoul(argv[a + 1], nullptr, 10));}
+        else if(std::strcmp(argv[a], "--sizes") == 0){sizes = parse_sizes(argv[a + 1]);}
+        else if(std::strcmp(argv[a], "--header") == 0){header = argv[a + 1];}
+        else{
+            std::cerr << "usage: " << argv[0] << " [--seed N] [--sizes 1000,10000,...] [--calls N] [--header PATH]" << std::endl;
+            return 1;
+        }
+    }
+    if(sizes.size() < 2){
+        std::cerr << "at least two sizes are needed for a fit" << std::endl;
+        return 1;
+    }
+
+    // The network build is timed as generate_network
+    auto const ops = operations();
+    auto estimates = read_estimates(header);
+    if(estimates.empty()){
+        std::cerr << "no estimates found in " << header << ", pass --header" << std::endl;
+        return 1;
+    }
+    bool covered = true;
+    for(auto const& op : ops){
+        if(estimates.count(op.name) == 0){
+            std::cerr << op.name << " has no estimate in " << header << std::endl;
+            covered = false;
+        }
+    }
+    for(auto const& estimate : estimates){
+        bool timed = estimate.first == "generate_network";
+        for(auto const& op : ops){timed = timed || op.name == estimate.first;}
+        if(!timed){
+            std::cerr << estimate.first << " is not benchmarked" << std::endl;
+            covered = false;
+        }
+        if(std::isnan(Growth(estimate.second, 1000).value())){
+            std::cerr << "cannot read the estimate O(" << estimate.second << ") of " << estimate.first << std::endl;
+            covered = false;
+        }
+    }
+    if(!covered){return 1;}
+
+    using Clock = std::chrono::steady_clock;
+    // Microseconds per call, build time last
+    std::vector<std::vector<double>> times(ops.size() + 1);
+    std::size_t sink = 0;
+
+    for(auto n : sizes){
+        std::cerr << "n = " << n << std::endl;
+        Inputs inputs(seed + n, n, calls);
+        Datastructures ds;
+        auto start = Clock::now();
+        ds.generate_network(seed, n);
+        times[ops.size()].push_back(std::chrono::duration<double, std::micro>(Clock::now() - start).count());
+
+        for(std::size_t o = 0; o < ops.size(); ++o){
+            unsigned int count = ops[o].max_calls == ALL ? calls : std::min(calls, ops[o].max_calls);
+            double fastest = std::numeric_limits<double>::max();
+            for(unsigned int round = 0; round < (ops[o].query ? QUERY_ROUNDS : 1); ++round){
+                start = Clock::now();
+                for(unsigned int i = 0; i < count; ++i){sink += ops[o].body(ds, inputs, i);}
+                fastest = std::min(fastest, std::chrono::duration<double, std::micro>(Clock::now() - start).count() / count);
+            }
+            times[o].push_back(fastest);
+        }
+    }
+
+    std::cout << std::left << std::setw(40) << "operation" << std::setw(32) << "estimate";
+    for(auto n : sizes){std::cout << std::right << std::setw(12) << ("n=" + std::to_string(n));}
+    std::cout << std::right << std::setw(8) << "slope" << std::setw(10) << "estimated" << "  " << std::left << std::setw(9) << "fit" << "\n";
+
+    unsigned int flagged = 0;
+    auto report = [&](std::string const& name, std::vector<double> const& row){
+        std::string const& expression = estimates[name];
+        std::vector<double> growth;
+        for(auto n : sizes){growth.push_back(Growth(expression, n).value());}
+        double expected = log_slope(sizes, growth);
+        auto result = fit(sizes, row);
+        bool slower = result.second > expected + SLOPE_TOLERANCE;
+        flagged += slower;
+        std::cout << std::left << std::setw(40) << name << std::setw(32) << ("O(" + expression + ")");
+        for(double t : row){std::cout << std::right << std::setw(12) << std::fixed << std::setprecision(2) << t;}
+        std::cout << std::right << std::setw(8) << std::setprecision(2) << result.second << std::setw(10) << expected << "  "
+                  << std::left << std::setw(9) << result.first->name << (slower ? "  grows faster than estimated" : "") << "\n";
+    };
+    for(std::size_t o = 0; o < ops.size(); ++o){report(ops[o].name, times[o]);}
+    report("generate_network", times[ops.size()]);
+
+    std::cout << "\ntimes are microseconds per call, " << flagged << " operations grew faster than estimated"
+              << " (checksum " << sink % 1000 << ")" << std::endl;
+    return 0;
+}
@@ -11,6 +11,26 @@
 #include <cmath>
 #include <iostream>
 #include <climits>
+#include <cstring>
+#include <fstream>
+#include <charconv>
+#include <string_view>
+#include <chrono>
+#include <array>
+#include <cstdio>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define DATASTRUCTURES_HAVE_MMAP 1
+#endif
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define DATASTRUCTURES_HAVE_AVX2 1
+#endif
 
 std::minstd_rand rand_engine; // Reasonably quick pseudo-random generator
 
@@ -25,6 +45,434 @@ Type random_in_range(Type start, Type end)
     return static_cast<Type>(start+num);
 }
 
+#ifdef DATASTRUCTURES_METRICS
+namespace
+{
+// Every public operation that is timed, views and Datastructures share the list
+#define DATASTRUCTURES_OPERATIONS(X) \
+    X(station_count) X(clear_all) X(all_stations) X(add_station) X(get_station_name) \
+    X(get_station_coordinates) X(stations_alphabetically) X(stations_with_prefix) X(stations_distance_increasing) \
+    X(find_station_with_coord) X(change_station_coord) X(add_departure) X(remove_departure) \
+    X(station_departures_after) X(add_region) X(all_regions) X(get_region_name) X(get_region_coords) \
+    X(add_subregion_to_region) X(add_station_to_region) X(station_in_regions) X(all_subregions_of_region) \
+    X(stations_closest_to) X(remove_station) X(common_parent_of_regions) X(add_train) \
+    X(next_stations_from) X(train_stations_from) X(trains_through_station) X(clear_trains) X(route_any) X(route_least_stations) \
+    X(route_with_cycle) X(route_shortest_distance) X(stations_nearest) X(stations_within_radius) \
+    X(route_earliest_arrival) X(route_pareto) X(is_subregion_of) X(regions_containing) \
+    X(assign_stations_to_regions_by_geometry) X(add_stations_bulk) X(add_regions_bulk) X(add_trains_bulk) \
+    X(save_snapshot) X(load_snapshot) X(pin) X(publish) X(ingest_stations) X(ingest_departures) \
+    X(ingest_trains) X(route_many) X(closest_many) X(generate_network) \
+    X(view_station_departures_after) X(view_route_least_stations) X(view_route_shortest_distance) \
+    X(view_route_earliest_arrival) X(for_each_station) X(for_each_station_alphabetically) \
+    X(for_each_station_by_distance) X(for_each_region) X(for_each_next_station)
+
+enum class Metric : unsigned int{
+#define DATASTRUCTURES_METRIC_ENUM(name) name,
+    DATASTRUCTURES_OPERATIONS(DATASTRUCTURES_METRIC_ENUM)
+#undef DATASTRUCTURES_METRIC_ENUM
+    none
+};
+std::size_t const METRIC_COUNT = static_cast<std::size_t>(Metric::none);
+
+char const* const METRIC_NAMES[METRIC_COUNT] = {
+#define DATASTRUCTURES_METRIC_NAME(name) #name,
+    DATASTRUCTURES_OPERATIONS(DATASTRUCTURES_METRIC_NAME)
+#undef DATASTRUCTURES_METRIC_NAME
+};
+
+// Bucket b counts the calls that took [2^b, 2^(b+1)) ns, the last one everything slower
+std::size_t const LATENCY_BUCKETS = 40;
+
+struct OperationCounters{
+    std::atomic<std::uint64_t> calls{0};
+    std::atomic<std::uint64_t> nanoseconds{0};
+    std::atomic<std::uint64_t> expanded{0};
+    std::atomic<std::uint64_t> latency[LATENCY_BUCKETS]{};
+};
+
+// Only the owning thread writes its counters, so a relaxed load and store is
+// enough and the hot path has no locked instructions. Snapshots read them
+// with relaxed loads while the owner keeps counting.
+void bump(std::atomic<std::uint64_t>& counter, std::uint64_t amount)
+{
+    counter.store(counter.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+}
+
+struct ThreadMetrics;
+
+// Counters of the running threads, and the sum of the threads that have finished
+struct MetricsRegistry{
+    std::mutex lock;
+    std::vector<ThreadMetrics*> threads;
+    std::uint64_t retired[METRIC_COUNT][3 + LATENCY_BUCKETS] = {};
+};
+
+MetricsRegistry& metrics_registry()
+{
+    static MetricsRegistry registry;
+    return registry;
+}
+
+struct ThreadMetrics{
+    OperationCounters operations[METRIC_COUNT];
+    // Operation that search expansions of this thread are counted to
+    Metric current = Metric::none;
+
+    ThreadMetrics()
+    {
+        MetricsRegistry& registry = metrics_registry();
+        std::lock_guard<std::mutex> guard(registry.lock);
+        registry.threads.push_back(this);
+    }
+    ~ThreadMetrics()
+    {
+        MetricsRegistry& registry = metrics_registry();
+        std::lock_guard<std::mutex> guard(registry.lock);
+        for(std::size_t m = 0; m < METRIC_COUNT; ++m){
+            add_to(m, registry.retired[m]);
+        }
+        registry.threads.erase(std::find(registry.threads.begin(), registry.threads.end(), this));
+    }
+    void add_to(std::size_t m, std::uint64_t* total) const
+    {
+        OperationCounters const& c = operations[m];
+        total[0] += c.calls.load(std::memory_order_relaxed);
+        total[1] += c.nanoseconds.load(std::memory_order_relaxed);
+        total[2] += c.expanded.load(std::memory_order_relaxed);
+        for(std::size_t b = 0; b < LATENCY_BUCKETS; ++b){
+            total[3 + b] += c.latency[b].load(std::memory_order_relaxed);
+        }
+    }
+};
+
+ThreadMetrics& thread_metrics()
+{
+    thread_local ThreadMetrics metrics;
+    return metrics;
+}
+
+/**
+ * @brief OperationScope counts the search expansions of this thread to an operation until destroyed
+ */
+class OperationScope{
+public:
+    explicit OperationScope(Metric operation) : metrics(thread_metrics()), outer(metrics.current)
+    {
+        metrics.current = operation;
+    }
+    ~OperationScope(){ metrics.current = outer; }
+    OperationScope(OperationScope const&) = delete;
+    OperationScope& operator=(OperationScope const&) = delete;
+
+protected:
+    ThreadMetrics& metrics;
+    Metric outer;
+};
+
+/**
+ * @brief OperationTimer counts one call of an operation and its latency when destroyed
+ */
+class OperationTimer : public OperationScope{
+public:
+    explicit OperationTimer(Metric operation)
+        : OperationScope(operation), operation(operation), start(std::chrono::steady_clock::now()) {}
+    ~OperationTimer()
+    {
+        auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+        std::uint64_t ns = static_cast<std::uint64_t>(std::max<decltype(elapsed)>(elapsed, 1));
+        std::size_t bucket = 0;
+        while(bucket + 1 < LATENCY_BUCKETS && (ns >> (bucket + 1)) != 0){++bucket;}
+
+        OperationCounters& c = metrics.operations[static_cast<std::size_t>(operation)];
+        bump(c.calls, 1);
+        bump(c.nanoseconds, ns);
+        bump(c.latency[bucket], 1);
+    }
+
+private:
+    Metric operation;
+    std::chrono::steady_clock::time_point start;
+};
+
+void count_expanded(std::uint64_t count)
+{
+    ThreadMetrics& metrics = thread_metrics();
+    if(metrics.current != Metric::none){
+        bump(metrics.operations[static_cast<std::size_t>(metrics.current)].expanded, count);
+    }
+}
+}
+
+#define OPERATION_METRICS(name) OperationTimer operation_timer_(Metric::name)
+#define OPERATION_SCOPE(name) OperationScope operation_scope_(Metric::name)
+#define SEARCH_EXPANDED(count) count_expanded(count)
+#else
+#define OPERATION_METRICS(name) static_cast<void>(0)
+#define OPERATION_SCOPE(name) static_cast<void>(0)
+#define SEARCH_EXPANDED(count) static_cast<void>(0)
+#endif
+
+namespace
+{
+/**
+ * @brief departures_after copies at most limit departures later than time from a sorted departure list
+ */
+template <typename Departures, typename TrainOf>
+std::vector<std::pair<Time, TrainID>> departures_after(Departures const& departures, Time time, unsigned int limit, TrainOf train_of)
+{
+    std::vector<std::pair<Time, TrainID>> result;
+    auto it = std::upper_bound(departures.begin(), departures.end(), time,
+                               [](Time t, std::pair<Time, TrainIndex> const& d){ return t < d.first; });
+    std::size_t count = std::min<std::size_t>(limit, departures.end() - it);
+    result.reserve(count);
+    for(auto end = it + count; it != end; ++it){
+        result.push_back(std::make_pair(it->first, train_of(it->second)));
+    }
+    return result;
+}
+
+/**
+ * @brief str_order sorts boxed items into sort-tile-recursive order: vertical slices by
+ * centre x, each slice sorted by centre y, so runs of FANOUT items are spatially compact
+ */
+template <typename Item, typename GetBox>
+void str_order(std::vector<Item>& items, GetBox box_of)
+{
+    auto centre_x = [&](Item const& a){ return double(box_of(a).min_x) + box_of(a).max_x; };
+    auto centre_y = [&](Item const& a){ return double(box_of(a).min_y) + box_of(a).max_y; };
+    std::sort(items.begin(), items.end(), [&](Item const& a, Item const& b){ return centre_x(a) < centre_x(b); });
+
+    std::size_t pages = (items.size() + RegionRTree::FANOUT - 1) / RegionRTree::FANOUT;
+    std::size_t slices = static_cast<std::size_t>(std::ceil(std::sqrt(double(pages))));
+    std::size_t slice_size = std::max<std::size_t>(1, slices) * RegionRTree::FANOUT;
+    for(std::size_t begin = 0; begin < items.size(); begin += slice_size){
+        auto end = items.begin() + std::min(items.size(), begin + slice_size);
+        std::sort(items.begin() + begin, end, [&](Item const& a, Item const& b){ return centre_y(a) < centre_y(b); });
+    }
+}
+
+/**
+ * @brief polygon_contains crossing number test, points on the boundary count as inside
+ * @param polygon param 1 vertices in order, the last one connects back to the first
+ * @param p param 2 point
+ * @return true if p is inside or on the polygon
+ */
+template <typename Polygon>
+bool polygon_contains(Polygon const& polygon, Coord p)
+{
+    if(polygon.size() < 3){return false;}
+    bool inside = false;
+    for(std::size_t i = 0, j = polygon.size() - 1; i < polygon.size(); j = i++){
+        std::int64_t xi = polygon[i].x, yi = polygon[i].y;
+        std::int64_t xj = polygon[j].x, yj = polygon[j].y;
+        std::int64_t cross = (xj - xi) * (p.y - yi) - (yj - yi) * (p.x - xi);
+        if(cross == 0 && std::min(xi, xj) <= p.x && p.x <= std::max(xi, xj)
+                      && std::min(yi, yj) <= p.y && p.y <= std::max(yi, yj)){
+            return true;
+        }
+        // Edge crosses the horizontal ray to the right of p, the sign of cross
+        // tells on which side of the upward or downward edge p lies
+        if((yi > p.y) != (yj > p.y)){
+            bool right_of_p = (yj > yi) ? cross > 0 : cross < 0;
+            if(right_of_p){inside = !inside;}
+        }
+    }
+    return inside;
+}
+
+// Snapshot file layout: header, a table of contents with one entry per
+// section kind and then the sections, each starting at a multiple of 8 so
+// the arrays can be used straight from a read-only mapping.
+// Strings are stored as a uint64 offset table (count + 1 entries) and one
+// character blob.
+enum SnapshotSection : std::uint32_t
+{
+    station_coords, station_id_offsets, station_id_chars, station_name_offsets, station_name_chars,
+    station_region, graph_offsets, graph_targets, graph_weights, graph_scale,
+    departure_offsets, departure_entries,
+    train_id_offsets, train_id_chars, train_added, train_stop_offsets, train_stops,
+    region_ids, region_parent, region_name_offsets, region_name_chars, region_coord_offsets, region_coords,
+    section_count
+};
+
+char const SNAPSHOT_MAGIC[8] = {'R', 'A', 'I', 'L', 'S', 'N', 'A', 'P'};
+std::uint32_t const SNAPSHOT_VERSION = 1;
+
+struct SnapshotHeader
+{
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t sections;
+    std::uint64_t offset[section_count];
+    std::uint64_t size[section_count];
+};
+
+struct SnapshotDeparture
+{
+    std::uint32_t train;
+    std::uint16_t time;
+    std::uint16_t padding;
+};
+
+struct SnapshotStop
+{
+    std::uint32_t station;
+    std::uint16_t time;
+    std::uint16_t padding;
+};
+
+/**
+ * @brief The SnapshotWriter class writes sections one after another and the header last
+ */
+class SnapshotWriter
+{
+public:
+    explicit SnapshotWriter(std::string const& path) : out_(path, std::ios::binary | std::ios::trunc)
+    {
+        std::memset(&header_, 0, sizeof(header_));
+        out_.write(reinterpret_cast<char const*>(&header_), sizeof(header_));
+    }
+
+    template <typename T>
+    void section(SnapshotSection kind, std::vector<T> const& data)
+    {
+        static char const zeros[8] = {};
+        auto position = static_cast<std::uint64_t>(out_.tellp());
+        out_.write(zeros, (8 - position % 8) % 8);
+        header_.offset[kind] = static_cast<std::uint64_t>(out_.tellp());
+        header_.size[kind] = data.size() * sizeof(T);
+        out_.write(reinterpret_cast<char const*>(data.data()), header_.size[kind]);
+    }
+
+    template <typename Range, typename GetString>
+    void strings(SnapshotSection offsets_kind, SnapshotSection chars_kind, Range const& items, GetString get)
+    {
+        std::vector<std::uint64_t> offsets{0};
+        std::vector<char> chars;
+        for(auto const& item : items){
+            std::string_view text = get(item);
+            chars.insert(chars.end(), text.begin(), text.end());
+            offsets.push_back(chars.size());
+        }
+        section(offsets_kind, offsets);
+        section(chars_kind, chars);
+    }
+
+    bool finish()
+    {
+        std::memcpy(header_.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+        header_.version = SNAPSHOT_VERSION;
+        header_.sections = section_count;
+        out_.seekp(0);
+        out_.write(reinterpret_cast<char const*>(&header_), sizeof(header_));
+        out_.flush();
+        return static_cast<bool>(out_);
+    }
+
+private:
+    std::ofstream out_;
+    SnapshotHeader header_;
+};
+
+/**
+ * @brief The SnapshotFile class maps a snapshot read-only and hands out its sections as typed arrays.
+ * Without mmap the file is read into memory instead.
+ */
+class SnapshotFile
+{
+public:
+    explicit SnapshotFile(std::string const& path)
+    {
+#ifdef DATASTRUCTURES_HAVE_MMAP
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if(fd < 0){return;}
+        struct stat info;
+        if(::fstat(fd, &info) == 0 && info.st_size > 0){
+            void* mapped = ::mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if(mapped != MAP_FAILED){
+                data_ = static_cast<char const*>(mapped);
+                size_ = static_cast<std::size_t>(info.st_size);
+                mapped_ = true;
+            }
+        }
+        ::close(fd);
+#else
+        std::ifstream in(path, std::ios::binary);
+        buffer_.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+        data_ = buffer_.data();
+        size_ = buffer_.size();
+#endif
+    }
+
+    ~SnapshotFile()
+    {
+#ifdef DATASTRUCTURES_HAVE_MMAP
+        if(mapped_){::munmap(const_cast<char*>(data_), size_);}
+#endif
+    }
+
+    SnapshotFile(SnapshotFile const&) = delete;
+    SnapshotFile& operator=(SnapshotFile const&) = delete;
+
+    bool valid() const
+    {
+        if(size_ < sizeof(SnapshotHeader)){return false;}
+        SnapshotHeader const& h = header();
+        if(std::memcmp(h.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) != 0){return false;}
+        if(h.version != SNAPSHOT_VERSION || h.sections != section_count){return false;}
+        for(std::uint32_t kind = 0; kind < section_count; ++kind){
+            if(h.offset[kind] % 8 != 0 || h.offset[kind] > size_ || h.size[kind] > size_ - h.offset[kind]){return false;}
+        }
+        return true;
+    }
+
+    // Number of T in a section, or NO_INDEX if its size is not a whole number of them
+    template <typename T>
+    std::size_t count(SnapshotSection kind) const
+    {
+        std::uint64_t bytes = header().size[kind];
+        return bytes % sizeof(T) == 0 ? bytes / sizeof(T) : NO_INDEX;
+    }
+
+    template <typename T>
+    T const* get(SnapshotSection kind) const
+    {
+        return reinterpret_cast<T const*>(data_ + header().offset[kind]);
+    }
+
+    // String i of a string table, the offsets must have been checked with strings_valid
+    std::string string(SnapshotSection offsets_kind, SnapshotSection chars_kind, std::size_t i) const
+    {
+        auto offsets = get<std::uint64_t>(offsets_kind);
+        return std::string(get<char>(chars_kind) + offsets[i], offsets[i + 1] - offsets[i]);
+    }
+
+    bool strings_valid(SnapshotSection offsets_kind, SnapshotSection chars_kind, std::size_t items) const
+    {
+        if(count<std::uint64_t>(offsets_kind) != items + 1){return false;}
+        auto offsets = get<std::uint64_t>(offsets_kind);
+        if(offsets[0] != 0 || offsets[items] != count<char>(chars_kind)){return false;}
+        return std::is_sorted(offsets, offsets + items + 1);
+    }
+
+private:
+    SnapshotHeader const& header() const { return *reinterpret_cast<SnapshotHeader const*>(data_); }
+
+    char const* data_ = nullptr;
+    std::size_t size_ = 0;
+    bool mapped_ = false;
+    std::vector<char> buffer_;
+};
+
+/**
+ * @brief offsets_valid checks a CSR style offset table of items + 1 entries that indexes total elements
+ */
+bool offsets_valid(std::uint32_t const* offsets, std::size_t entries, std::size_t total)
+{
+    return entries > 0 && offsets[0] == 0 && offsets[entries - 1] == total && std::is_sorted(offsets, offsets + entries);
+}
+}
+
 // Modify the code below to implement the functionality of the class.
 // Also remove comments from the parameter names when you implement
 // an operation (Commenting out parameter name prevents compiler from
@@ -35,11 +483,10 @@ Type random_in_range(Type start, Type end)
 Datastructures::Datastructures()
 {
 
-  departures_vec = std::vector<std::pair<TrainID, Time>>();
-  regions_map = std::unordered_map<RegionID, Region>();
-  stations_map = std::unordered_map<StationID, Station>();
-  coord_map = std::map<Coord, StationID, CoordComparator>();
-  train_map = std::unordered_map<TrainID, Train>();
+  station_lookup = std::unordered_map<StationID, StationIndex>();
+  coord_map = std::map<Coord, StationIndex, CoordComparator>();
+  train_lookup = std::unordered_map<TrainID, TrainIndex>();
+  publish();
 
 
 }
@@ -54,7 +501,8 @@ Datastructures::~Datastructures()
  */
 unsigned int Datastructures::station_count()
 {
-    return stations_map.size();
+    OPERATION_METRICS(station_count);
+    return station_lookup.size();
 }
 
 /**
@@ -62,12 +510,29 @@ unsigned int Datastructures::station_count()
  */
 void Datastructures::clear_all()
 {
-
-stations_map.clear();
-regions_map.clear();
-departures_vec.clear();
+    OPERATION_METRICS(clear_all);
+
+stations.clear();
+station_columns.clear();
+station_lookup.clear();
+regions_map = RegionMap(&entity_memory);
+region_forest = RegionForest();
+region_forest_valid = false;
+region_tree = RegionRTree();
+region_tree_valid = false;
 coord_map.clear();
 stations_sorted.clear();
+trains.clear();
+train_ids.clear();
+train_lookup.clear();
+station_grid.clear();
+heuristic_scale = 1.0;
+removed_count = 0;
+invalidate_network();
+everything_changed = true;
+// Nothing allocated from the pool is left
+entity_memory.release();
+entity_arena.release();
 
 }
 /**
@@ -76,8 +541,10 @@ stations_sorted.clear();
  */
 std::vector<StationID> Datastructures::all_stations()
 {
+    OPERATION_METRICS(all_stations);
     std::vector<StationID> all_stations_vec;
-    for(auto& station : stations_map){
+    all_stations_vec.reserve(station_lookup.size());
+    for(auto& station : station_lookup){
         all_stations_vec.push_back(station.first);
     }
 
@@ -92,12 +559,17 @@ std::vector<StationID> Datastructures::all_stations()
  */
 bool Datastructures::add_station(StationID id, const Name& name, Coord coord)
 {
+    OPERATION_METRICS(add_station);
 
-if(stations_map.find(id)!=stations_map.end()){return false;}
+if(station_lookup.find(id)!=station_lookup.end()){return false;}
 
-stations_map[id] = Station{id, name, coord, departures_vec, nullptr, neighbours};
-stations_sorted[name] = {id};
-coord_map[coord] = {id};
+StationIndex index = static_cast<StationIndex>(stations.size());
+append_station(id, name, coord);
+stations_sorted.insert(index);
+station_lookup.emplace(std::move(id), index);
+coord_map[coord] = index;
+station_grid.insert(coord, index);
+stations_changed = true;
     return true;
 
 }
@@ -108,9 +580,11 @@ coord_map[coord] = {id};
  */
 Name Datastructures::get_station_name(StationID id)
 {
+    OPERATION_METRICS(get_station_name);
 
-    if(stations_map.find(id)==stations_map.end()){return NO_NAME;}
-    return stations_map[id].name;
+    StationIndex index = find_station(id);
+    if(index == NO_INDEX){return NO_NAME;}
+    return Name(stations[index].name);
 }
 
 /**
@@ -120,31 +594,63 @@ Name Datastructures::get_station_name(StationID id)
  */
 Coord Datastructures::get_station_coordinates(StationID id)
 {
-    if(stations_map.find(id)==stations_map.end()){return NO_COORD;}
-    return stations_map[id].coord;
+    OPERATION_METRICS(get_station_coordinates);
+    StationIndex index = find_station(id);
+    if(index == NO_INDEX){return NO_COORD;}
+    return station_columns.coord(index);
 }
 /**
- * @brief stations_alphabetically function that lists all stations alphabetically using stations_sorted map
+ * @brief stations_alphabetically function that lists all stations alphabetically using the stations_sorted index
  * @return vector of stationids
  */
 std::vector<StationID> Datastructures::stations_alphabetically()
 {
+    OPERATION_METRICS(stations_alphabetically);
         std::vector<StationID> temp;
-        for( auto it = stations_sorted.begin(); it != stations_sorted.end(); ++it ) {
-               temp.push_back( it->second );
-           }
+        temp.reserve(stations_sorted.size());
+        stations_sorted.page("", nullptr, stations_sorted.size(), temp);
         return temp;
 }
+/**
+ * @brief stations_alphabetically function that lists one page of the stations in alphabetical order
+ * @param from_name param 1 first name of the page
+ * @param count param 2 most stations returned
+ * @param after_id param 3 id of the last station of the previous page, NO_STATION starts at the first station named from_name
+ * @return vector of stationids
+ */
+std::vector<StationID> Datastructures::stations_alphabetically(Name const& from_name, unsigned int count, StationID const& after_id)
+{
+    OPERATION_METRICS(stations_alphabetically);
+    std::vector<StationID> temp;
+    temp.reserve(std::min<std::size_t>(count, stations_sorted.size()));
+    stations_sorted.page(from_name, after_id == NO_STATION ? nullptr : &after_id, count, temp);
+    return temp;
+}
+/**
+ * @brief stations_with_prefix function that lists the stations whose name starts with prefix
+ * @param prefix param 1 start of the name
+ * @param limit param 2 most stations returned
+ * @return vector of stationids in alphabetical order
+ */
+std::vector<StationID> Datastructures::stations_with_prefix(Name const& prefix, unsigned int limit)
+{
+    OPERATION_METRICS(stations_with_prefix);
+    std::vector<StationID> temp;
+    stations_sorted.with_prefix(prefix, limit, temp);
+    return temp;
+}
 /**
  * @brief stations_distance_increasing function that lists all stations sort by distance using coord_map
  * @return vector of stationids
  */
 std::vector<StationID> Datastructures::stations_distance_increasing()
 {
+    OPERATION_METRICS(stations_distance_increasing);
     std::vector<StationID> temp;
+    temp.reserve(coord_map.size());
 
     for (auto it = coord_map.begin(); it != coord_map.end(); it++){
-        temp.push_back(it -> second);
+        temp.push_back(stations[it -> second].id);
     }
     return temp;
 
@@ -156,8 +662,10 @@ std::vector<StationID> Datastructures::stations_distance_increasing()
  */
 StationID Datastructures::find_station_with_coord(Coord xy)
 {
-   if(coord_map.find(xy) == coord_map.end()){return NO_STATION;}
-   return coord_map.at(xy);
+    OPERATION_METRICS(find_station_with_coord);
+   auto it = coord_map.find(xy);
+   if(it == coord_map.end()){return NO_STATION;}
+   return stations[it->second].id;
 }
 /**
  * @brief change_station_coord function that change the coordinates of given Station by stationid
@@ -167,15 +675,22 @@ StationID Datastructures::find_station_with_coord(Coord xy)
  */
 bool Datastructures::change_station_coord(StationID id, Coord newcoord)
 {
-    if(stations_map.find(id) == stations_map.end()){return false;}
-
-   if (coord_map.find(stations_map.at(id).coord) != coord_map.end()) {
-            coord_map.erase(stations_map.at(id).coord);
-            stations_map.at(id).coord = newcoord;
-            coord_map.insert({newcoord, id});
-            return true;
-        }
-        return false;
+    OPERATION_METRICS(change_station_coord);
+    StationIndex index = find_station(id);
+    if(index == NO_INDEX){return false;}
+
+    Coord oldcoord = station_columns.coord(index);
+    // The old coordinate may already belong to a station added or moved there later
+    auto it = coord_map.find(oldcoord);
+    if(it != coord_map.end() && it->second == index){coord_map.erase(it);}
+    station_grid.erase(oldcoord, index);
+    station_grid.insert(newcoord, index);
+    station_columns.set_coord(index, newcoord);
+    // The station placed last at a coordinate wins, like in add_station
+    coord_map[newcoord] = index;
+    update_edge_weights(index);
+    stations_changed = true;
+    return true;
 }
 /**
  * @brief add_departure function that adds a departure to the given station by station id
@@ -186,11 +701,13 @@ bool Datastructures::change_station_coord(StationID id, Coord newcoord)
  */
 bool Datastructures::add_departure(StationID stationid, TrainID trainid, Time time)
 {
-    if(stations_map.find(stationid) == stations_map.end()){
+    OPERATION_METRICS(add_departure);
+    StationIndex index = find_station(stationid);
+    if(index == NO_INDEX){
             return false;
         }
         else{
-            stations_map[stationid].departures.push_back(std::make_pair(trainid, time));
+            insert_departure(index, intern_train(trainid), time);
             return true;
         }
     return true;
@@ -204,13 +721,19 @@ bool Datastructures::add_departure(StationID stationid, TrainID trainid, Time ti
  */
 bool Datastructures::remove_departure(StationID stationid, TrainID trainid, Time time)
 {
-    if(stations_map.find(stationid) == stations_map.end()){
+    OPERATION_METRICS(remove_departure);
+    StationIndex index = find_station(stationid);
+    TrainIndex train = find_train(trainid);
+    if(index == NO_INDEX || train == NO_INDEX){
           return false;
       }
       else{
-          for(auto it = stations_map[stationid].departures.begin(); it != stations_map[stationid].departures.end(); ++it){
-              if(it->first == trainid && it->second == time){
-                  stations_map[stationid].departures.erase(it);
+          auto& departures = stations[index].departures;
+          auto it = std::lower_bound(departures.begin(), departures.end(), std::make_pair(time, TrainIndex(0)));
+          for(; it != departures.end() && it->first == time; ++it){
+              if(it->second == train){
+                  departures.erase(it);
+                  departures_changed(index);
                   return true;
               }
           }
@@ -225,19 +748,24 @@ bool Datastructures::remove_departure(StationID stationid, TrainID trainid, Time
  */
 std::vector<std::pair<Time, TrainID>> Datastructures::station_departures_after(StationID stationid, Time time)
 {
-    std::vector<std::pair<Time, TrainID>> result;
-    if(stations_map.find(stationid) == stations_map.end()){
-        result.push_back(std::make_pair(NO_TIME, NO_TRAIN));
-        return result;
+    return station_departures_after(stationid, time, std::numeric_limits<unsigned int>::max());
+}
+/**
+ * @brief station_departures_after function that lists at most limit departures of a station after given time
+ * @param id param 1
+ * @param time param 2
+ * @param limit param 3 maximum number of departures returned
+ * @return vector pair of time and trainid
+ */
+std::vector<std::pair<Time, TrainID>> Datastructures::station_departures_after(StationID stationid, Time time, unsigned int limit)
+{
+    OPERATION_METRICS(station_departures_after);
+    StationIndex index = find_station(stationid);
+    if(index == NO_INDEX){
+        return {std::make_pair(NO_TIME, NO_TRAIN)};
     }
     else{
-        for(auto it = stations_map[stationid].departures.begin(); it != stations_map[stationid].departures.end(); ++it){
-            if(it->second > time){
-                result.push_back(std::make_pair(it->second, it->first));
-            }
-        }
-        std::sort(result.begin(), result.end(), [&](std::pair<Time, TrainID> a, std::pair<Time, TrainID> b) {return a.first < b.first;});
-        return result;
+        return departures_after(stations[index].departures, time, limit, [this](TrainIndex t){ return train_ids[t]; });
     }
 }
 /**
@@ -249,10 +777,13 @@ std::vector<std::pair<Time, TrainID>> Datastructures::station_departures_after(S
  */
 bool Datastructures::add_region(RegionID id, const Name &name, std::vector<Coord> coords)
 {
+    OPERATION_METRICS(add_region);
 
    if(regions_map.find(id)!=regions_map.end()){return false;}
 
-    regions_map[id] = Region{name, coords, id, nullptr};
+    regions_map.emplace(id, new_region(id, name, coords));
+    region_forest_valid = false;
+    region_tree_valid = false;
     return true;
 
 }
@@ -262,6 +793,7 @@ bool Datastructures::add_region(RegionID id, const Name &name, std::vector<Coord
  */
 std::vector<RegionID> Datastructures::all_regions()
 {
+    OPERATION_METRICS(all_regions);
     std::vector<RegionID> regions_vec;
     for(auto& region : regions_map){
         regions_vec.push_back(region.first);
@@ -276,9 +808,10 @@ std::vector<RegionID> Datastructures::all_regions()
  */
 Name Datastructures::get_region_name(RegionID id)
 {
+    OPERATION_METRICS(get_region_name);
 
     if(regions_map.find(id)==regions_map.end()){return NO_NAME;}
-    return regions_map[id].name;
+    return Name(regions_map[id].name);
 }
 
 /**
@@ -288,9 +821,10 @@ Name Datastructures::get_region_name(RegionID id)
  */
 std::vector<Coord> Datastructures::get_region_coords(RegionID id)
 {
+    OPERATION_METRICS(get_region_coords);
 
     if(regions_map.find(id)==regions_map.end()){return std::vector<Coord>{NO_COORD};}
-        return regions_map[id].coord;
+        return std::vector<Coord>(regions_map[id].coord.begin(), regions_map[id].coord.end());
 
 }
 
@@ -302,11 +836,20 @@ std::vector<Coord> Datastructures::get_region_coords(RegionID id)
  */
 bool Datastructures::add_subregion_to_region(RegionID id, RegionID parentid)
 {
+    OPERATION_METRICS(add_subregion_to_region);
 
-    if(regions_map.find(id)==regions_map.end() || regions_map.find(parentid)==regions_map.end()){return false;}
+    auto region = regions_map.find(id);
+    auto parent = regions_map.find(parentid);
+    if(region == regions_map.end() || parent == regions_map.end()){return false;}
 
-    if(regions_map[id].parent != nullptr){return false;}
-    regions_map[id].parent = &regions_map[parentid];
+    if(region->second.parent != nullptr){return false;}
+    // Refuse to make a region its own ancestor
+    for(Region* ancestor = &parent->second; ancestor != nullptr; ancestor = ancestor->parent){
+        if(ancestor == &region->second){return false;}
+    }
+    region->second.parent = &parent->second;
+    parent->second.children.push_back(&region->second);
+    region_forest_valid = false;
         return true;
 
 }
@@ -318,8 +861,10 @@ bool Datastructures::add_subregion_to_region(RegionID id, RegionID parentid)
  */
 bool Datastructures::add_station_to_region(StationID id, RegionID parentid)
 {
-    if(stations_map.find(id)==stations_map.end() || regions_map.find(parentid)==regions_map.end()){return false;}
-        stations_map[id].ptr = &regions_map[parentid];
+    OPERATION_METRICS(add_station_to_region);
+    StationIndex index = find_station(id);
+    if(index == NO_INDEX || regions_map.find(parentid)==regions_map.end()){return false;}
+        station_columns.region[index] = &regions_map[parentid];
         return true;
 }
 
@@ -330,10 +875,12 @@ bool Datastructures::add_station_to_region(StationID id, RegionID parentid)
  */
 std::vector<RegionID> Datastructures::station_in_regions(StationID id)
 {
+    OPERATION_METRICS(station_in_regions);
     std::vector<RegionID> result;
-    if(stations_map.find(id)==stations_map.end()){result.push_back(NO_REGION); return result;}
+    StationIndex index = find_station(id);
+    if(index == NO_INDEX){result.push_back(NO_REGION); return result;}
 
-    Region* regionPtr = stations_map[id].ptr;
+    Region* regionPtr = station_columns.region[index];
     while (regionPtr != nullptr) {
         result.push_back(regionPtr -> id);
         regionPtr = regionPtr -> parent;
@@ -348,13 +895,15 @@ std::vector<RegionID> Datastructures::station_in_regions(StationID id)
  */
 std::vector<RegionID> Datastructures::all_subregions_of_region(RegionID id)
 {
+    OPERATION_METRICS(all_subregions_of_region);
     std::vector<RegionID> result;
-    if(regions_map.find(id)==regions_map.end()){result.push_back(NO_REGION) ; return result;}
+    auto region = regions_map.find(id);
+    if(region==regions_map.end()){result.push_back(NO_REGION) ; return result;}
 
-    for(auto it = regions_map.begin(); it != regions_map.end(); ++it){
-        if(it->second.parent != nullptr && it->second.parent->id == id){
-             result.push_back(it->first);
-            }
+    const RegionForest& forest = regions_indexed();
+    result.reserve(region->second.tout - region->second.tin - 1);
+    for(auto i = region->second.tin + 1; i < region->second.tout; ++i){
+             result.push_back(forest.order[i]->id);
           }
     return result;
 }
@@ -365,26 +914,16 @@ std::vector<RegionID> Datastructures::all_subregions_of_region(RegionID id)
  */
 std::vector<StationID> Datastructures::stations_closest_to(Coord xy)
 {
-    std::vector<Station> stations;
-    for (auto& station : stations_map)
-    {
-        stations.push_back(station.second);
-    }
-
-    std::partial_sort(stations.begin(), stations.begin() + 3, stations.end(), [xy](const auto &a, const auto &b){
-        return sqrt( pow(a.coord.x - xy.x, 2) + pow(a.coord.y - xy.y, 2)) <
-                sqrt( pow(b.coord.x - xy.x, 2) + pow(b.coord.y - xy.y, 2)); });
-
+    OPERATION_METRICS(stations_closest_to);
+    std::vector<SpatialGrid::Hit> hits;
+    station_grid.nearest(xy, 3, hits);
 
-    std::vector<StationID> closest_three = {};
-    for (unsigned i = 0; i < stations.size(); i++) {
-        if (i == 3) {
-            break;
-        }
-        closest_three.push_back(stations[i].id);
+    std::vector<StationID> result;
+    result.reserve(hits.size());
+    for(auto const& hit : hits){
+        result.push_back(stations[hit.second].id);
     }
-
-    return closest_three;
+    return result;
 
 }
 /**
@@ -394,20 +933,36 @@ std::vector<StationID> Datastructures::stations_closest_to(Coord xy)
  */
 bool Datastructures::remove_station(StationID id)
 {
+    OPERATION_METRICS(remove_station);
 
-    auto station_iter = stations_map.find(id);
-    if (station_iter == stations_map.end())
+    auto station_iter = station_lookup.find(id);
+    if (station_iter == station_lookup.end())
     {
         return false;
     }
 
-    auto station = station_iter->second;
+    StationIndex index = station_iter->second;
+    Station& station = stations[index];
+
+    station_lookup.erase(station_iter);
+    stations_sorted.erase(index);
+    Coord coord = station_columns.coord(index);
+    auto coord_iter = coord_map.find(coord);
+    if (coord_iter != coord_map.end() && coord_iter->second == index){coord_map.erase(coord_iter);}
+    station_grid.erase(coord, index);
 
-    stations_map.erase(station_iter);
-    stations_sorted.erase(station.name);
-    coord_map.erase(station.coord);
+    // Only the snapshots built over the trains through the station change
+    if(!station.train_stops.empty()){invalidate_network();}
+    unlink_station(index);
 
+    // The slot stays allocated so other indices remain valid, searches skip it
+    station.removed = true;
+    station.departures.clear();
+    stations_changed = true;
+    departures_changed(index);
 
+    ++removed_count;
+    if(removed_count >= COMPACT_AFTER && removed_count > stations.size() - removed_count){compact_stations();}
     return true;
 }
 /**
@@ -418,31 +973,92 @@ bool Datastructures::remove_station(StationID id)
  */
 RegionID Datastructures::common_parent_of_regions(RegionID id1, RegionID id2)
 {
-    if(regions_map.find(id1)==regions_map.end() || regions_map.find(id2)==regions_map.end()){return NO_REGION;}
-
-      std::vector<RegionID> id1Parents;
-      std::vector<RegionID> id2Parents;
-
-      Region* regionPtr = &regions_map[id1];
-      while (regionPtr != nullptr) {
-          id1Parents.push_back(regionPtr -> id);
-          regionPtr = regionPtr -> parent;
+    OPERATION_METRICS(common_parent_of_regions);
+    auto region1 = regions_map.find(id1);
+    auto region2 = regions_map.find(id2);
+    if(region1==regions_map.end() || region2==regions_map.end()){return NO_REGION;}
+
+      const RegionForest& forest = regions_indexed();
+      Region const& a = region1->second;
+      Region const& b = region2->second;
+      if(RegionForest::is_ancestor(a, b)){return a.id;}
+      if(RegionForest::is_ancestor(b, a)){return b.id;}
+
+      // Lift a to the highest ancestor that is still not above b, its parent is the answer
+      std::uint32_t position = a.tin;
+      for(auto level = forest.up.size(); level-- > 0; ){
+          std::uint32_t jump = forest.up[level][position];
+          if(!RegionForest::is_ancestor(*forest.order[jump], b)){position = jump;}
       }
+      Region const& top = *forest.order[forest.up[0][position]];
+      if(!RegionForest::is_ancestor(top, b)){return NO_REGION;}
+      return top.id;
+}
+/**
+ * @brief is_subregion_of function that tells if a region is directly or indirectly inside another
+ * @param id param 1
+ * @param parentid param 2
+ * @return true if parentid is an ancestor of id
+ */
+bool Datastructures::is_subregion_of(RegionID id, RegionID parentid)
+{
+    OPERATION_METRICS(is_subregion_of);
+    auto region = regions_map.find(id);
+    auto parent = regions_map.find(parentid);
+    if(region==regions_map.end() || parent==regions_map.end() || id == parentid){return false;}
 
-      regionPtr = &regions_map[id2];
-      while (regionPtr != nullptr) {
-          id2Parents.push_back(regionPtr -> id);
-          regionPtr = regionPtr -> parent;
-      }
+    regions_indexed();
+    return RegionForest::is_ancestor(parent->second, region->second);
+}
+/**
+ * @brief regions_indexed numbers the regions in preorder and builds the binary lifting tables if the hierarchy changed
+ * @return region forest index
+ */
+const RegionForest& Datastructures::regions_indexed()
+{
+    if(region_forest_valid){return region_forest;}
+
+    RegionForest forest;
+    forest.order.reserve(regions_map.size());
+    std::vector<std::uint32_t> parent_position;
+    parent_position.reserve(regions_map.size());
+
+    // Iterative preorder so deep hierarchies do not overflow the stack,
+    // the stack holds (region, next child to visit)
+    std::vector<std::pair<Region*, std::size_t>> stack;
+    for(auto& entry : regions_map){
+        if(entry.second.parent != nullptr){continue;}
+        stack.push_back({&entry.second, 0});
+        entry.second.tin = static_cast<std::uint32_t>(forest.order.size());
+        forest.order.push_back(&entry.second);
+        parent_position.push_back(entry.second.tin);
+        while(!stack.empty()){
+            auto& top = stack.back();
+            if(top.second == top.first->children.size()){
+                top.first->tout = static_cast<std::uint32_t>(forest.order.size());
+                stack.pop_back();
+                continue;
+            }
+            Region* child = top.first->children[top.second++];
+            child->tin = static_cast<std::uint32_t>(forest.order.size());
+            forest.order.push_back(child);
+            parent_position.push_back(top.first->tin);
+            stack.push_back({child, 0});
+        }
+    }
 
-      for(auto it = id1Parents.begin(); it != id1Parents.end(); ++it){
-          for(auto it2 = id2Parents.begin(); it2 != id2Parents.end(); ++it2){
-              if(*it == *it2){
-                  return *it;
-              }
-          }
-      }
-      return NO_REGION;
+    forest.up.push_back(std::move(parent_position));
+    std::size_t count = forest.order.size();
+    for(std::size_t span = 2; span < count; span *= 2){
+        auto const& half = forest.up.back();
+        std::vector<std::uint32_t> level(count);
+        for(std::size_t i = 0; i < count; ++i){level[i] = half[half[i]];}
+        forest.up.push_back(std::move(level));
+    }
+
+    region_forest = std::move(forest);
+    region_forest_valid = true;
+    return region_forest;
 }
 /**
  * @brief add_train adds trainid and vector of pairs to datastructures
@@ -451,27 +1067,45 @@ RegionID Datastructures::common_parent_of_regions(RegionID id1, RegionID id2)
  * @return bool
  */
 
+
 bool Datastructures::add_train(TrainID trainid, std::vector<std::pair<StationID, Time> > stationtimes)
 
 {
-    if(train_map.find(trainid) != train_map.end()){return false;}
-    for (const auto& StationID : stationtimes){
-        if(stations_map.find(StationID.first) == stations_map.end()){return false;}
-    }
-
-
-    train_map[trainid] = Train{stationtimes};
-
-    for (auto it = stationtimes.begin(); it != stationtimes.end()-1; it++){
-        stations_map [it -> first].neighbours.push_back((it + 1) -> first);
-        stations_map[it ->first].departures.push_back(std::make_pair(trainid, it->second));
-
-
+    OPERATION_METRICS(add_train);
+    TrainIndex existing = find_train(trainid);
+    if(existing != NO_INDEX && trains[existing].added){return false;}
+    if(stationtimes.empty()){return false;}
 
+    std::vector<std::pair<StationIndex, Time>> stops;
+    stops.reserve(stationtimes.size());
+    for (const auto& StationID : stationtimes){
+        StationIndex index = find_station(StationID.first);
+        if(index == NO_INDEX){return false;}
+        stops.push_back(std::make_pair(index, StationID.second));
     }
 
+    add_train_stops(trainid, std::move(stops));
     return true;
 }
+/**
+ * @brief Datastructures::add_train_stops stores an already validated train and links its stops
+ * @param trainid param 1 train that is not added yet
+ * @param stops param 2 at least one stop, every station exists
+ */
+void Datastructures::add_train_stops(TrainID const& trainid, std::vector<std::pair<StationIndex, Time>> stops)
+{
+    TrainIndex train = intern_train(trainid);
+    trains[train].stationtimes.assign(stops.begin(), stops.end());
+    trains[train].added = true;
+    auto const& stationstops = trains[train].stationtimes;
+
+    for (auto it = stationstops.begin(); it != stationstops.end()-1; it++){
+        add_edge(it->first, (it + 1)->first);
+        insert_departure(it->first, train, it->second);
+    }
+    index_train_stops(train);
+    invalidate_network();
+}
 /**
  * @brief next_stations_from finds the next stations from given parameter
  * @param id param 1 StationID
@@ -479,9 +1113,16 @@ bool Datastructures::add_train(TrainID trainid, std::vector<std::pair<StationID,
  */
 std::vector<StationID> Datastructures::next_stations_from(StationID id)
 {
-     if(stations_map.find(id) == stations_map.end()){return std::vector<StationID>{NO_STATION};}
+    OPERATION_METRICS(next_stations_from);
+     StationIndex index = find_station(id);
+     if(index == NO_INDEX){return std::vector<StationID>{NO_STATION};}
 
-     return stations_map[id].neighbours;
+     std::vector<StationID> result;
+     result.reserve(stations[index].neighbours.size());
+     for(auto next : stations[index].neighbours){
+         if(!stations[next].removed){result.push_back(stations[next].id);}
+     }
+     return result;
 
 }
 /**
@@ -493,22 +1134,26 @@ std::vector<StationID> Datastructures::next_stations_from(StationID id)
  */
 std::vector<StationID> Datastructures::train_stations_from(StationID stationid, TrainID trainid)
 {
+    OPERATION_METRICS(train_stations_from);
 
     std::vector<StationID> nextstations;
-       if(stations_map.find(stationid) == stations_map.end()){
+       StationIndex index = find_station(stationid);
+       if(index == NO_INDEX){
            return std::vector<StationID>{NO_STATION};
        }
-       if(train_map.find(trainid) == train_map.end()){
+       TrainIndex train = find_train(trainid);
+       if(train == NO_INDEX || !trains[train].added){
            return std::vector<StationID>{NO_STATION};
        }
 
-       for (auto it = train_map[trainid].stationtimes.begin(); it != train_map[trainid].stationtimes.end(); it++){
-           if(it->first == stationid){
-               for (auto it2 = it; it2 != train_map[trainid].stationtimes.end(); it2++){
-                   if(it2->first != stationid){
-                   nextstations.push_back(it2->first);
-                   }
-
+       auto const& stationtimes = trains[train].stationtimes;
+       auto const& by_station = trains[train].stops_by_station;
+       // Every stop at the station adds the rest of the trip after it
+       for (auto it = std::lower_bound(by_station.begin(), by_station.end(), std::make_pair(index, std::uint32_t(0)));
+            it != by_station.end() && it->first == index; ++it){
+           for (std::size_t next = it->second + 1; next < stationtimes.size(); ++next){
+               if(stationtimes[next].first != index){
+               nextstations.push_back(stations[stationtimes[next].first].id);
                }
            }
        }
@@ -518,123 +1163,532 @@ std::vector<StationID> Datastructures::train_stations_from(StationID stationid,
        return nextstations;
 
 }
+/**
+ * @brief Datastructures::trains_through_station lists the trains that stop at a station
+ * @param id param 1 StationID
+ * @return train ids in interning order, NO_TRAIN if the station does not exist
+ */
+std::vector<TrainID> Datastructures::trains_through_station(StationID id)
+{
+    OPERATION_METRICS(trains_through_station);
+    StationIndex index = find_station(id);
+    if(index == NO_INDEX){return std::vector<TrainID>{NO_TRAIN};}
+
+    std::vector<TrainID> result;
+    TrainIndex previous = NO_INDEX;
+    for(auto const& stop : stations[index].train_stops){
+        if(stop.first != previous){result.push_back(train_ids[stop.first]);}
+        previous = stop.first;
+    }
+    return result;
+}
 /**
  * @brief Datastructures::clear_trains clears the train datastructure
  */
 void Datastructures::clear_trains()
 {
-    train_map.clear();
-    for(auto it = stations_map.begin(); it != stations_map.end(); ++it){
-            it->second.neighbours.clear();
+    OPERATION_METRICS(clear_trains);
+    // Train IDs stay interned because departures may still refer to them
+    for(auto& train : trains){
+            // Assigning a fresh Train would leave the stops on the default resource
+            train.stationtimes.clear();
+            train.stationtimes.shrink_to_fit();
+            train.stops_by_station.clear();
+            train.stops_by_station.shrink_to_fit();
+            train.added = false;
+        }
+    for(auto it = stations.begin(); it != stations.end(); ++it){
+            it->neighbours.clear();
+            it->neighbour_weights.clear();
+            it->predecessors.clear();
+            it->train_stops.clear();
         }
+    heuristic_scale = 1.0;
+    invalidate_network();
+}
+namespace
+{
+Distance straight_distance(Coord a, Coord b)
+{
+    std::int64_t dx = std::int64_t(a.x) - b.x;
+    std::int64_t dy = std::int64_t(a.y) - b.y;
+    return static_cast<Distance>(std::sqrt(double(dx * dx + dy * dy)));
 }
+
 /**
- * @brief Datastructures::route_any find any route between fromid and toid
- * @param fromid param 1 Starting station
- * @param toid param 2 Destination station
- * @return vector with stationID's and distances on the route
+ * @brief search_fewest_hops breadth first search from fromid until toid is dequeued
+ * @return true if toid was reached, ws holds the parent of every reached station
  */
-
-// HUOM. Jos kirjoittaisin alemmat funktion uudelleen, tekisin joitain asioita eri tavalla
-// mm. visited unordered_set sijaan käyttäisin enum tyyppiä asemissa, mikä kuvastaa onko asema
-// käsitelty tai vaihtoehtoisesti boolean arvoa..
-// Tekisin myös erillisen funktion, ettei samaa koodia tarvitsisi toistaa alemmissa funktioissa.´
-std::vector<std::pair<StationID, Distance>> Datastructures::route_any(StationID fromid, StationID toid)
+bool search_fewest_hops(Graph const& g, std::size_t n, StationIndex fromid, StationIndex toid, SearchWorkspace& ws)
 {
-    std::vector<std::pair<StationID, Distance>> result;
-
-    if(stations_map.find(fromid) == stations_map.end() || stations_map.find(toid) == stations_map.end()){return std::vector<std::pair<StationID, Distance>>{{NO_STATION, NO_DISTANCE}};}
-    std::unordered_set<std::string> visited;
-    std::vector<StationID> queue;
-    std::unordered_map<StationID, StationID> parent;
-    queue.push_back(fromid);
-    visited.insert(fromid);
-    parent[fromid] = fromid;
-
-    while(!queue.empty()){
-        StationID current = queue.front();
-        queue.erase(queue.begin());
-        for(auto it = stations_map[current].neighbours.begin(); it != stations_map[current].neighbours.end(); ++it){
-            if(visited.find(*it) == visited.end()){
-                queue.push_back(*it);
-                visited.insert(*it);
-                parent[*it] = current;
+    ws.start(n);
+    ws.push(fromid);
+    ws.reach(fromid, fromid);
+
+    while(!ws.empty()){
+        StationIndex current = ws.pop();
+        if(current == toid){break;}
+        for(auto e = g.edges_begin(current); e != g.edges_end(current); ++e){
+            StationIndex next = g.targets[e];
+            if(!ws.is_reached(next)){
+                ws.push(next);
+                ws.reach(next, current, e);
+            }
+        }
+    }
+    SEARCH_EXPANDED(ws.head);
+    return ws.is_reached(toid);
+}
 
+/**
+ * @brief search_shortest Dijkstra / A* search from fromid until toid is settled.
+ * The binary heap has no decrease-key, outdated entries are skipped when popped.
+ * @param coord_of coordinate of a station, used by the heuristic
+ * @param astar guide the search with the straight line distance to toid
+ * @return true if toid was reached, ws holds the parent of every reached station
+ */
+template <typename CoordOf>
+bool search_shortest(Graph const& g, std::size_t n, CoordOf coord_of, StationIndex fromid, StationIndex toid,
+                     bool astar, SearchWorkspace& ws)
+{
+    const Coord target = coord_of(toid);
+    const double scale = astar ? g.heuristic_scale : 0.0;
+    auto heuristic = [&](StationIndex v){
+        const Coord c = coord_of(v);
+        return static_cast<Distance>(scale * std::hypot(double(c.x) - target.x, double(c.y) - target.y));
+    };
+
+    auto later = std::greater<std::pair<Distance, StationIndex>>();
+    auto& heap = ws.heap;
+    ws.start(n);
+
+    ws.reach(fromid, fromid);
+    ws.distance[fromid] = 0;
+    heap.push_back({heuristic(fromid), fromid});
+    while(!heap.empty()){
+        std::pop_heap(heap.begin(), heap.end(), later);
+        StationIndex current = heap.back().second;
+        heap.pop_back();
+        if(ws.is_settled(current)){continue;}
+        ws.settle(current);
+        SEARCH_EXPANDED(1);
+        if(current == toid){return true;}
+
+        for(auto e = g.edges_begin(current); e != g.edges_end(current); ++e){
+            StationIndex next = g.targets[e];
+            Distance candidate = ws.distance[current] + g.weights[e];
+            if(ws.is_settled(next)){continue;}
+            if(!ws.is_reached(next) || candidate < ws.distance[next]){
+                ws.reach(next, current, e);
+                ws.distance[next] = candidate;
+                heap.push_back({candidate + heuristic(next), next});
+                std::push_heap(heap.begin(), heap.end(), later);
             }
         }
     }
+    return false;
+}
 
-    if(visited.find(toid) == visited.end()){return std::vector<std::pair<StationID, Distance>>{};}
-    StationID current = toid;
+/**
+ * @brief build_route walks the parent chain from toid back to fromid, the distances are the stored
+ * weights of the graph edges the search took
+ * @return stationids and cumulative distances on the route
+ */
+template <typename IdOf>
+std::vector<std::pair<StationID, Distance>> build_route(Graph const& g, SearchWorkspace const& ws, StationIndex fromid,
+                                                        StationIndex toid, IdOf id_of)
+{
+    std::vector<std::pair<StationID, Distance>> result;
+    StationIndex current = toid;
 
     while(current != fromid){
-        result.push_back(std::make_pair(current, distance_between(parent[current], current)));
-        current = parent[current];
+        result.push_back(std::make_pair(id_of(current), g.weights[ws.parent_edge[current]]));
+        current = ws.parent[current];
     }
-    result.push_back(std::make_pair(fromid, 0));
-   std::reverse(result.begin(), result.end());
-   unsigned x = 1;
-
-   for (x = 1; x < result.size(); x++){
-       result[x].second += result[x-1].second;
-   }
+    result.push_back(std::make_pair(id_of(fromid), 0));
+    std::reverse(result.begin(), result.end());
 
+    for (unsigned x = 1; x < result.size(); x++){
+        result[x].second += result[x-1].second;
+    }
     return result;
-
 }
+
 /**
- * @brief Datastructures::route_least_stations Finds the route with least stations using route_any() function
- * @param fromid param 1 Starting stations
- * @param toid param 2 destination station
- * @return vector with stationID's and distances on the route
+ * @brief scan_connections connection scan from fromid leaving at departure_time, stops once
+ * no later connection can improve the arrival at toid
+ * @return true if toid was reached, ws.distance holds arrival times and ws.parent the
+ * connection used to get to each station
  */
-std::vector<std::pair<StationID, Distance>> Datastructures::route_least_stations(StationID fromid, StationID toid)
+bool scan_connections(std::vector<Connection> const& hops, std::size_t n, std::size_t train_count,
+                      StationIndex fromid, StationIndex toid, Time departure_time, SearchWorkspace& ws)
 {
-    std::vector<std::pair<StationID, Distance>> result = route_any(fromid, toid);
-    return result;
+    ws.start(n, train_count);
+    ws.reach(fromid, NO_INDEX);
+    ws.distance[fromid] = departure_time;
+
+    auto first = std::lower_bound(hops.begin(), hops.end(), departure_time,
+                                  [](Connection const& c, Time t){ return c.departure < t; });
+    auto c = first;
+    for(; c != hops.end(); ++c){
+        if(ws.is_reached(toid) && ws.distance[toid] <= c->departure){break;}
+        bool on_board = ws.boarded[c->train] == ws.epoch;
+        if(!on_board && !(ws.is_reached(c->from) && ws.distance[c->from] <= c->departure)){continue;}
+
+        ws.boarded[c->train] = ws.epoch;
+        if(!ws.is_reached(c->to) || c->arrival < ws.distance[c->to]){
+            ws.reach(c->to, static_cast<std::uint32_t>(c - hops.begin()));
+            ws.distance[c->to] = c->arrival;
+        }
+    }
+    SEARCH_EXPANDED(c - first);
+    return ws.is_reached(toid);
 }
+
 /**
- * @brief Datastructures::route_with_cycle finds a route with cycle
- * @param fromid param 1 starting station
- * @return vector with stationid's where first is fromid and last is the first repeated stationID
+ * @brief build_journey walks the connections found by scan_connections back from toid
+ * @return (station, train taken from it, time) for every stop, the last entry is the arrival at toid
  */
-std::vector<StationID> Datastructures::route_with_cycle(StationID fromid)
+template <typename IdOf, typename TrainOf>
+std::vector<std::tuple<StationID, TrainID, Time>> build_journey(std::vector<Connection> const& hops, SearchWorkspace const& ws,
+                                                                StationIndex fromid, StationIndex toid, IdOf id_of, TrainOf train_of)
 {
+    std::vector<std::tuple<StationID, TrainID, Time>> result;
+    result.push_back(std::make_tuple(id_of(toid), NO_TRAIN, static_cast<Time>(ws.distance[toid])));
+    for(StationIndex current = toid; current != fromid; ){
+        Connection const& c = hops[ws.parent[current]];
+        result.push_back(std::make_tuple(id_of(c.from), train_of(c.train), c.departure));
+        current = c.from;
+    }
+    std::reverse(result.begin(), result.end());
+    return result;
+}
+}
+
+/**
+ * @brief Datastructures::distance_between straight line distance of two stations truncated to whole metres
+ * @param fromid param 1 station
+ * @param toid param 2 station
+ * @return distance
+ */
+int Datastructures::distance_between(StationIndex fromid, StationIndex toid)
+{
+    return straight_distance(station_columns.coord(fromid), station_columns.coord(toid));
+}
+/**
+ * @brief Datastructures::add_edge adds a train hop with its length to the adjacency of both ends
+ * @param fromid param 1 station the hop leaves
+ * @param toid param 2 station the hop arrives at
+ */
+void Datastructures::add_edge(StationIndex fromid, StationIndex toid)
+{
+    Distance weight = distance_between(fromid, toid);
+    double length = std::hypot(double(station_columns.x[fromid]) - station_columns.x[toid],
+                               double(station_columns.y[fromid]) - station_columns.y[toid]);
+    if(length > 0){heuristic_scale = std::min(heuristic_scale, weight / length);}
+    stations[fromid].neighbours.push_back(toid);
+    stations[fromid].neighbour_weights.push_back(weight);
+    stations[toid].predecessors.push_back(fromid);
+}
+/**
+ * @brief Datastructures::remove_edge removes one train hop from the adjacency of both ends, keeping the order of the rest
+ * @param fromid param 1 station the hop leaves
+ * @param toid param 2 station the hop arrives at
+ */
+void Datastructures::remove_edge(StationIndex fromid, StationIndex toid)
+{
+    Station& from = stations[fromid];
+    auto next = std::find(from.neighbours.begin(), from.neighbours.end(), toid);
+    if(next != from.neighbours.end()){
+        from.neighbour_weights.erase(from.neighbour_weights.begin() + (next - from.neighbours.begin()));
+        from.neighbours.erase(next);
+    }
+    auto& predecessors = stations[toid].predecessors;
+    auto previous = std::find(predecessors.begin(), predecessors.end(), fromid);
+    if(previous != predecessors.end()){predecessors.erase(previous);}
+}
+/**
+ * @brief Datastructures::unlink_station takes a station out of every train stopping at it. The hops to and
+ * from the station are removed and each train gets a direct hop between the stops around it.
+ * @param v param 1 station being removed
+ */
+void Datastructures::unlink_station(StationIndex v)
+{
+    Station& station = stations[v];
+    std::vector<TrainIndex> through;
+    for(auto const& stop : station.train_stops){
+        if(through.empty() || through.back() != stop.first){through.push_back(stop.first);}
+    }
+
+    for(auto train : through){
+        auto& stops = trains[train].stationtimes;
+        for(std::size_t i = 0; i + 1 < stops.size(); ++i){
+            if(stops[i].first == v || stops[i + 1].first == v){remove_edge(stops[i].first, stops[i + 1].first);}
+        }
+        // Bridge every run of stops at v that has a stop on both sides. Stops at the same
+        // station on both sides get a hop to itself, like add_train gives two such stops
+        // in a row, so the hops stay one per pair of consecutive stops.
+        for(std::size_t i = 0; i < stops.size(); ++i){
+            if(stops[i].first != v || i == 0 || stops[i - 1].first == v){continue;}
+            std::size_t next = i;
+            while(next < stops.size() && stops[next].first == v){++next;}
+            if(next < stops.size()){add_edge(stops[i - 1].first, stops[next].first);}
+        }
+        // The stops after v move up, so the train is indexed again
+        unindex_train_stops(train);
+        stops.erase(std::remove_if(stops.begin(), stops.end(), [v](std::pair<StationIndex, Time> const& stop){ return stop.first == v; }),
+                    stops.end());
+        index_train_stops(train);
+    }
+    station.neighbours.clear();
+    station.neighbour_weights.clear();
+    station.predecessors.clear();
+}
+/**
+ * @brief Datastructures::index_train_stops builds the stop index of a train and adds its stops to the
+ * stop lists of the stations
+ * @param train param 1 train whose stationtimes are set
+ */
+void Datastructures::index_train_stops(TrainIndex train)
+{
+    auto const& stops = trains[train].stationtimes;
+    auto& by_station = trains[train].stops_by_station;
+    by_station.clear();
+    by_station.reserve(stops.size());
+    for(std::uint32_t i = 0; i < stops.size(); ++i){
+        by_station.push_back(std::make_pair(stops[i].first, i));
+        // Trains are mostly indexed in increasing order, so this is nearly always an append
+        auto& at = stations[stops[i].first].train_stops;
+        auto stop = std::make_pair(train, i);
+        at.insert(std::upper_bound(at.begin(), at.end(), stop), stop);
+    }
+    std::sort(by_station.begin(), by_station.end());
+}
+/**
+ * @brief Datastructures::unindex_train_stops drops the stop index of a train and its stops from the stop
+ * lists of the stations
+ * @param train param 1 indexed train
+ */
+void Datastructures::unindex_train_stops(TrainIndex train)
+{
+    auto& by_station = trains[train].stops_by_station;
+    for(std::size_t i = 0; i < by_station.size(); ++i){
+        if(i > 0 && by_station[i - 1].first == by_station[i].first){continue;}
+        auto& at = stations[by_station[i].first].train_stops;
+        auto first = std::lower_bound(at.begin(), at.end(), std::make_pair(train, std::uint32_t(0)));
+        auto last = std::lower_bound(first, at.end(), std::make_pair(train + 1, std::uint32_t(0)));
+        at.erase(first, last);
+    }
+    by_station.clear();
+}
+/**
+ * @brief Datastructures::compact_stations drops the slots of removed stations and renumbers the live ones
+ * densely in every index. The snapshots are rebuilt and the next publish copies everything.
+ */
+void Datastructures::compact_stations()
+{
+    std::vector<StationIndex> renumber(stations.size(), NO_INDEX);
+    StationIndex live = 0;
+    for(StationIndex v = 0; v < stations.size(); ++v){
+        if(stations[v].removed){continue;}
+        renumber[v] = live;
+        if(live != v){
+            stations[live] = std::move(stations[v]);
+            station_columns.x[live] = station_columns.x[v];
+            station_columns.y[live] = station_columns.y[v];
+            station_columns.region[live] = station_columns.region[v];
+        }
+        ++live;
+    }
+    stations.erase(stations.begin() + live, stations.end());
+    station_columns.x.resize(live);
+    station_columns.y.resize(live);
+    station_columns.region.resize(live);
+
+    for(auto& station : stations){
+        for(auto& next : station.neighbours){next = renumber[next];}
+        for(auto& previous : station.predecessors){previous = renumber[previous];}
+    }
+    // Renumbering keeps the order of the live stations, so the stop indexes stay sorted
+    for(auto& train : trains){
+        for(auto& stop : train.stationtimes){stop.first = renumber[stop.first];}
+        for(auto& stop : train.stops_by_station){stop.first = renumber[stop.first];}
+    }
+    for(auto& entry : station_lookup){entry.second = renumber[entry.second];}
+    for(auto& entry : coord_map){entry.second = renumber[entry.second];}
+    stations_sorted.renumber(renumber);
+    station_grid.clear();
+    for(StationIndex v = 0; v < live; ++v){station_grid.insert(station_columns.coord(v), v);}
+
+    removed_count = 0;
+    departure_pages_changed.clear();
+    invalidate_network();
+    everything_changed = true;
+}
+/**
+ * @brief Datastructures::update_edge_weights recomputes the lengths of the hops to and from a moved station.
+ * The graph snapshot is patched in place when no published view shares it, otherwise it is rebuilt on next use.
+ * @param v param 1 station whose coordinates changed
+ */
+void Datastructures::update_edge_weights(StationIndex v)
+{
+    Graph* g = graph_snapshot.use_count() == 1 ? graph_snapshot.get() : nullptr;
+    if(g == nullptr){graph_snapshot.reset();}
+    auto update = [&](StationIndex from, StationIndex to, Distance& weight){
+        weight = distance_between(from, to);
+        double length = std::hypot(double(station_columns.x[from]) - station_columns.x[to],
+                                   double(station_columns.y[from]) - station_columns.y[to]);
+        // The ratio of the old length may have been the smallest, a lower scale stays admissible
+        if(length > 0){heuristic_scale = std::min(heuristic_scale, weight / length);}
+    };
+
+    Station& station = stations[v];
+    for(std::size_t i = 0; i < station.neighbours.size(); ++i){
+        update(v, station.neighbours[i], station.neighbour_weights[i]);
+    }
+    for(auto from : station.predecessors){
+        Station& source = stations[from];
+        for(std::size_t i = 0; i < source.neighbours.size(); ++i){
+            if(source.neighbours[i] == v){update(from, v, source.neighbour_weights[i]);}
+        }
+    }
+
+    if(g == nullptr){return;}
+    g->heuristic_scale = heuristic_scale;
+    for(auto e = g->edges_begin(v); e != g->edges_end(v); ++e){
+        g->weights[e] = distance_between(v, g->targets[e]);
+    }
+    for(auto from : station.predecessors){
+        for(auto e = g->edges_begin(from); e != g->edges_end(from); ++e){
+            if(g->targets[e] == v){g->weights[e] = distance_between(from, v);}
+        }
+    }
+}
+/**
+ * @brief Datastructures::graph returns the CSR snapshot of the network, building it if out of date
+ * @return graph with flat offset, target and weight arrays
+ */
+const Graph& Datastructures::graph()
+{
+    if(graph_snapshot){return *graph_snapshot;}
+
+    auto snapshot = std::make_shared<Graph>();
+    snapshot->offsets.reserve(stations.size() + 1);
+    std::size_t edge_count = 0;
+    for(auto const& station : stations){edge_count += station.neighbours.size();}
+    snapshot->targets.reserve(edge_count);
+    snapshot->weights.reserve(edge_count);
+
+    snapshot->heuristic_scale = heuristic_scale;
+    snapshot->offsets.push_back(0);
+    for(StationIndex v = 0; v < stations.size(); ++v){
+        Station const& station = stations[v];
+        if(!station.removed){
+            for(std::size_t i = 0; i < station.neighbours.size(); ++i){
+                if(stations[station.neighbours[i]].removed){continue;}
+                snapshot->targets.push_back(station.neighbours[i]);
+                snapshot->weights.push_back(station.neighbour_weights[i]);
+            }
+        }
+        snapshot->offsets.push_back(static_cast<std::uint32_t>(snapshot->targets.size()));
+    }
+
+    graph_snapshot = std::move(snapshot);
+    return *graph_snapshot;
+}
+/**
+ * @brief Datastructures::route_any find any route between fromid and toid
+ * @param fromid param 1 Starting station
+ * @param toid param 2 Destination station
+ * @return vector with stationID's and distances on the route
+ */
+
+// HUOM. Jos kirjoittaisin alemmat funktion uudelleen, tekisin joitain asioita eri tavalla
+// mm. visited unordered_set sijaan käyttäisin enum tyyppiä asemissa, mikä kuvastaa onko asema
+// käsitelty tai vaihtoehtoisesti boolean arvoa..
+// Tekisin myös erillisen funktion, ettei samaa koodia tarvitsisi toistaa alemmissa funktioissa.´
+std::vector<std::pair<StationID, Distance>> Datastructures::route_any(StationID fromid, StationID toid)
+{
+    OPERATION_METRICS(route_any);
+    return route_on(graph(), fromid, toid, true);
+}
+/**
+ * @brief Datastructures::route_on searches a route on a graph snapshot that is already built,
+ * only reads the datastructure so several threads may call it at once
+ * @param g param 1 graph snapshot
+ * @param fromid param 2 starting station
+ * @param toid param 3 destination station
+ * @param fewest_stations param 4 breadth first search instead of A*
+ * @return vector with stationID's and cumulative distances on the route
+ */
+std::vector<std::pair<StationID, Distance>> Datastructures::route_on(Graph const& g, StationID const& fromid, StationID const& toid,
+                                                                     bool fewest_stations) const
+{
+    StationIndex from = find_station(fromid);
+    StationIndex to = find_station(toid);
+    if(from == NO_INDEX || to == NO_INDEX){return std::vector<std::pair<StationID, Distance>>{{NO_STATION, NO_DISTANCE}};}
+
+    SearchWorkspace& ws = SearchWorkspace::for_thread();
+    auto coord_of = [this](StationIndex v){ return station_columns.coord(v); };
+    bool found = fewest_stations ? search_fewest_hops(g, stations.size(), from, to, ws)
+                                 : search_shortest(g, stations.size(), coord_of, from, to, true, ws);
+    if(!found){return std::vector<std::pair<StationID, Distance>>{};}
+    return build_route(g, ws, from, to, [this](StationIndex v){ return stations[v].id; });
+}
+/**
+ * @brief Datastructures::route_least_stations Finds the route with least stations
+ * @param fromid param 1 Starting stations
+ * @param toid param 2 destination station
+ * @return vector with stationID's and distances on the route
+ */
+std::vector<std::pair<StationID, Distance>> Datastructures::route_least_stations(StationID fromid, StationID toid)
+{
+    OPERATION_METRICS(route_least_stations);
+    return route_on(graph(), fromid, toid, true);
+}
+/**
+ * @brief Datastructures::route_with_cycle finds a route with cycle
+ * @param fromid param 1 starting station
+ * @return vector with stationid's where first is fromid and last is the first repeated stationID
+ */
+std::vector<StationID> Datastructures::route_with_cycle(StationID fromid)
+{
+    OPERATION_METRICS(route_with_cycle);
     std::vector<StationID> result;
-    if(stations_map.find(fromid) == stations_map.end()){return std::vector<StationID>{NO_STATION};}
-
-    std::unordered_set<std::string> visited;
-    std::vector<StationID> queue;
-    std::unordered_map<StationID, StationID> parent;
-    queue.push_back(fromid);
-    visited.insert(fromid);
-    parent[fromid] = fromid;
-    while(!queue.empty()){
-        StationID current = queue.front();
-        queue.erase(queue.begin());
-        for(auto it = stations_map[current].neighbours.begin(); it != stations_map[current].neighbours.end(); ++it){
-            if(visited.find(*it) == visited.end()){
-                queue.push_back(*it);
-                visited.insert(*it);
-                parent[*it] = current;
+    StationIndex from = find_station(fromid);
+    if(from == NO_INDEX){return std::vector<StationID>{NO_STATION};}
+
+    const Graph& g = graph();
+    SearchWorkspace& ws = SearchWorkspace::for_thread();
+    ws.start(stations.size());
+    ws.push(from);
+    ws.reach(from, from);
+    while(!ws.empty()){
+        StationIndex current = ws.pop();
+        for(auto e = g.edges_begin(current); e != g.edges_end(current); ++e){
+            StationIndex next = g.targets[e];
+            if(!ws.is_reached(next)){
+                ws.push(next);
+                ws.reach(next, current);
 
             }
             else{
-                StationID current2 = current;
-                while(current2 != fromid){
-                    result.push_back(current2);
-                    current2 = parent[current2];
+                StationIndex current2 = current;
+                while(current2 != from){
+                    result.push_back(stations[current2].id);
+                    current2 = ws.parent[current2];
                 }
 
                 result.push_back(fromid);
 
                 std::reverse(result.begin(), result.end());
-                result.push_back(*it);
+                result.push_back(stations[next].id);
+                SEARCH_EXPANDED(ws.head);
                 return result;
             }
         }
     }
-
+    SEARCH_EXPANDED(ws.head);
 return result;
 }
 /**
@@ -645,49 +1699,2106 @@ return result;
  */
 std::vector<std::pair<StationID, Distance>> Datastructures::route_shortest_distance(StationID fromid, StationID toid)
 {
-    std::vector<std::pair<StationID, Distance>> result;
-    if(stations_map.find(fromid) == stations_map.end() || stations_map.find(toid) == stations_map.end()){return std::vector<std::pair<StationID, Distance>>{{NO_STATION, NO_DISTANCE}};}
-
-    std::unordered_set<std::string> visited;
-    std::vector<StationID> queue;
-    std::unordered_map<StationID, StationID> parent;
-    std::unordered_map<StationID, Distance> distance;
-    queue.push_back(fromid);
-    visited.insert(fromid);
-    parent[fromid] = fromid;
-    distance[fromid] = 0;
-    while(!queue.empty()){
-        StationID current = queue.front();
-        queue.erase(queue.begin());
-        for(auto it = stations_map[current].neighbours.begin(); it != stations_map[current].neighbours.end(); ++it){
-            if(visited.find(*it) == visited.end()){
-                queue.push_back(*it);
-                visited.insert(*it);
-                parent[*it] = current;
-                distance[*it] = distance[current] + distance_between(current, *it);
+    OPERATION_METRICS(route_shortest_distance);
+    return route_on(graph(), fromid, toid, false);
+}
+/**
+ * @brief Datastructures::connections returns every train hop sorted by departure time, building it if out of date
+ * @return connections sorted by departure and then arrival time
+ */
+const std::vector<Connection>& Datastructures::connections()
+{
+    if(connection_snapshot){return *connection_snapshot;}
+
+    auto snapshot = std::make_shared<std::vector<Connection>>();
+    for(TrainIndex train = 0; train < trains.size(); ++train){
+        auto const& stops = trains[train].stationtimes;
+        // A train whose times go backwards cannot be scanned in time order
+        bool ordered = std::is_sorted(stops.begin(), stops.end(), [](std::pair<StationIndex, Time> const& a,
+                                                                     std::pair<StationIndex, Time> const& b){ return a.second < b.second; });
+        if(!ordered){continue;}
+        // Removed stations are skipped so the train still links the stops around them,
+        // otherwise staying on board could carry over a gap in the trip
+        std::size_t previous = stops.size();
+        for(std::size_t i = 0; i < stops.size(); ++i){
+            if(stations[stops[i].first].removed){continue;}
+            if(previous != stops.size()){
+                snapshot->push_back(Connection{stops[previous].second, stops[i].second, stops[previous].first, stops[i].first, train});
+            }
+            previous = i;
+        }
+    }
+    // Stable so the hops of one train with equal times stay in trip order
+    std::stable_sort(snapshot->begin(), snapshot->end(), [](Connection const& a, Connection const& b){
+        return a.departure < b.departure || (a.departure == b.departure && a.arrival < b.arrival);
+    });
+
+    connection_snapshot = std::move(snapshot);
+    return *connection_snapshot;
+}
+/**
+ * @brief Datastructures::patterns returns the trains grouped into RAPTOR route patterns, building them if out of date
+ * @return route patterns with their trips in time order
+ */
+const RoutePatterns& Datastructures::patterns()
+{
+    if(pattern_snapshot){return *pattern_snapshot;}
+
+    // Group the trains by stop sequence, removed stations are left out of the sequence
+    std::map<std::vector<StationIndex>, std::vector<std::pair<TrainIndex, std::vector<Time>>>> groups;
+    for(TrainIndex train = 0; train < trains.size(); ++train){
+        std::vector<StationIndex> sequence;
+        std::vector<Time> times;
+        for(auto const& stop : trains[train].stationtimes){
+            if(stations[stop.first].removed){continue;}
+            sequence.push_back(stop.first);
+            times.push_back(stop.second);
+        }
+        if(sequence.size() < 2 || !std::is_sorted(times.begin(), times.end())){continue;}
+        groups[std::move(sequence)].push_back({train, std::move(times)});
+    }
+
+    auto snapshot = std::make_shared<RoutePatterns>();
+    RoutePatterns& rp = *snapshot;
+    rp.stop_begin.push_back(0);
+    rp.trip_begin.push_back(0);
+    for(auto& group : groups){
+        auto& trips = group.second;
+        std::sort(trips.begin(), trips.end(), [](auto const& a, auto const& b){ return a.second < b.second; });
+
+        // Split the trips so that no trip overtakes the one before it
+        std::vector<std::vector<std::size_t>> fifo;
+        for(std::size_t i = 0; i < trips.size(); ++i){
+            bool placed = false;
+            for(auto& pattern : fifo){
+                auto const& last = trips[pattern.back()].second;
+                bool overtakes = false;
+                for(std::size_t p = 0; p < last.size() && !overtakes; ++p){
+                    overtakes = trips[i].second[p] < last[p];
+                }
+                if(!overtakes){pattern.push_back(i); placed = true; break;}
             }
-            else if(distance[current] + distance_between(current, *it) < distance[*it]){
-                parent[*it] = current;
-                distance[*it] = distance[current] + distance_between(current, *it);
+            if(!placed){fifo.push_back({i});}
+        }
+
+        for(auto const& pattern : fifo){
+            rp.time_begin.push_back(static_cast<std::uint32_t>(rp.times.size()));
+            rp.stops.insert(rp.stops.end(), group.first.begin(), group.first.end());
+            rp.stop_begin.push_back(static_cast<std::uint32_t>(rp.stops.size()));
+            for(auto i : pattern){
+                rp.trips.push_back(trips[i].first);
+                rp.times.insert(rp.times.end(), trips[i].second.begin(), trips[i].second.end());
             }
+            rp.trip_begin.push_back(static_cast<std::uint32_t>(rp.trips.size()));
         }
     }
-    if(visited.find(toid) == visited.end()){return std::vector<std::pair<StationID, Distance>>{};}
-    StationID current = toid;
-    while(current != fromid){
-        result.push_back(std::make_pair(current, distance_between(parent[current], current)));
 
-        current = parent[current];
+    // Reverse index from station to the patterns stopping there
+    rp.station_begin.assign(stations.size() + 1, 0);
+    for(auto v : rp.stops){++rp.station_begin[v + 1];}
+    for(std::size_t v = 0; v < stations.size(); ++v){rp.station_begin[v + 1] += rp.station_begin[v];}
+    rp.station_patterns.resize(rp.stops.size());
+    std::vector<std::uint32_t> fill(rp.station_begin.begin(), rp.station_begin.end() - 1);
+    for(std::uint32_t r = 0; r < rp.pattern_count(); ++r){
+        for(std::uint32_t p = 0; p < rp.stop_count(r); ++p){
+            rp.station_patterns[fill[rp.stops[rp.stop_begin[r] + p]]++] = {r, p};
+        }
     }
-    result.push_back(std::make_pair(fromid, 0));
-    std::reverse(result.begin(), result.end());
-    unsigned x = 1;
-    for (x = 1; x < result.size(); x++){
-        result[x].second += result[x-1].second;
+
+    pattern_snapshot = std::move(snapshot);
+    return *pattern_snapshot;
+}
+/**
+ * @brief SearchWorkspace::for_thread returns the search workspace of the calling thread
+ * @return workspace that keeps its buffers between queries
+ */
+SearchWorkspace& SearchWorkspace::for_thread()
+{
+    thread_local SearchWorkspace ws;
+    return ws;
+}
+/**
+ * @brief Datastructures::stations_nearest returns the k stations closest to a coordinate
+ * @param xy param 1 coordinate
+ * @param k param 2 how many stations are wanted
+ * @return vector of stationids, closest first
+ */
+std::vector<StationID> Datastructures::stations_nearest(Coord xy, unsigned int k)
+{
+    OPERATION_METRICS(stations_nearest);
+    std::vector<SpatialGrid::Hit> hits;
+    station_grid.nearest(xy, k, hits);
+
+    std::vector<StationID> result;
+    result.reserve(hits.size());
+    for(auto const& hit : hits){
+        result.push_back(stations[hit.second].id);
+    }
+    return result;
+}
+/**
+ * @brief Datastructures::stations_within_radius returns the stations at most radius away from a coordinate
+ * @param xy param 1 coordinate
+ * @param radius param 2 maximum distance
+ * @return vector of stationids, closest first
+ */
+std::vector<StationID> Datastructures::stations_within_radius(Coord xy, Distance radius)
+{
+    OPERATION_METRICS(stations_within_radius);
+    std::vector<SpatialGrid::Hit> hits;
+    station_grid.within(xy, radius, hits);
+
+    std::vector<StationID> result;
+    result.reserve(hits.size());
+    for(auto const& hit : hits){
+        result.push_back(stations[hit.second].id);
     }
     return result;
+}
+namespace
+{
+/**
+ * @brief squared_distances_scalar squared distance from xy to each of n points given as x and y arrays.
+ * Each square fits in 64 unsigned bits, their sum saturates.
+ */
+void squared_distances_scalar(int const* x, int const* y, std::size_t n, Coord xy, std::uint64_t* out)
+{
+    for(std::size_t i = 0; i < n; ++i){
+        std::uint64_t dx = static_cast<std::uint64_t>(std::abs(std::int64_t(x[i]) - xy.x));
+        std::uint64_t dy = static_cast<std::uint64_t>(std::abs(std::int64_t(y[i]) - xy.y));
+        std::uint64_t sum = dx * dx + dy * dy;
+        out[i] = sum < dx * dx ? std::numeric_limits<std::uint64_t>::max() : sum;
+    }
+}
 
+#ifdef DATASTRUCTURES_HAVE_AVX2
+/**
+ * @brief squared_distances_avx2 four points per step. Differences are taken in 64 bit lanes,
+ * their absolute value fits in 32 bits so the unsigned 32 x 32 -> 64 multiply squares it exactly.
+ * A sum that carries out of 64 bits saturates like in the scalar kernel.
+ */
+__attribute__((target("avx2")))
+void squared_distances_avx2(int const* x, int const* y, std::size_t n, Coord xy, std::uint64_t* out)
+{
+    const __m256i qx = _mm256_set1_epi64x(xy.x);
+    const __m256i qy = _mm256_set1_epi64x(xy.y);
+    const __m256i zero = _mm256_setzero_si256();
+    // AVX2 only compares signed lanes, flipping the top bit compares them unsigned
+    const __m256i top = _mm256_set1_epi64x(std::numeric_limits<std::int64_t>::min());
+    std::size_t i = 0;
+    for(; i + 4 <= n; i += 4){
+        __m256i dx = _mm256_sub_epi64(_mm256_cvtepi32_epi64(_mm_loadu_si128(reinterpret_cast<__m128i const*>(x + i))), qx);
+        __m256i dy = _mm256_sub_epi64(_mm256_cvtepi32_epi64(_mm_loadu_si128(reinterpret_cast<__m128i const*>(y + i))), qy);
+        __m256i sx = _mm256_cmpgt_epi64(zero, dx);
+        __m256i sy = _mm256_cmpgt_epi64(zero, dy);
+        dx = _mm256_sub_epi64(_mm256_xor_si256(dx, sx), sx);
+        dy = _mm256_sub_epi64(_mm256_xor_si256(dy, sy), sy);
+        __m256i xx = _mm256_mul_epu32(dx, dx);
+        __m256i d = _mm256_add_epi64(xx, _mm256_mul_epu32(dy, dy));
+        __m256i carry = _mm256_cmpgt_epi64(_mm256_xor_si256(xx, top), _mm256_xor_si256(d, top));
+        d = _mm256_or_si256(d, carry);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), d);
+    }
+    squared_distances_scalar(x + i, y + i, n - i, xy, out + i);
 }
+#endif
 
+/**
+ * @brief squared_distances batch kernel of the spatial queries, uses AVX2 when the processor has it
+ */
+void squared_distances(int const* x, int const* y, std::size_t n, Coord xy, std::uint64_t* out)
+{
+    using Kernel = void (*)(int const*, int const*, std::size_t, Coord, std::uint64_t*);
+    static Kernel const kernel = []() -> Kernel {
+#ifdef DATASTRUCTURES_HAVE_AVX2
+        if(__builtin_cpu_supports("avx2")){return squared_distances_avx2;}
+#endif
+        return squared_distances_scalar;
+    }();
+    kernel(x, y, n, xy, out);
+}
 
+/**
+ * @brief for_each_squared_distance calls visit(i, d) for every station i of a grid cell,
+ * d is its squared distance to xy. Distances are computed in batches on the stack.
+ */
+template <typename Cell, typename Visit>
+void for_each_squared_distance(Cell const& cell, Coord xy, Visit visit)
+{
+    constexpr std::size_t BATCH = 64;
+    std::uint64_t distances[BATCH];
+    const std::size_t n = cell.stations.size();
+    for(std::size_t begin = 0; begin < n; begin += BATCH){
+        std::size_t count = std::min(BATCH, n - begin);
+        squared_distances(cell.x.data() + begin, cell.y.data() + begin, count, xy, distances);
+        for(std::size_t i = 0; i < count; ++i){visit(begin + i, distances[i]);}
+    }
+}
+}
+/**
+ * @brief SpatialGrid::squared_distances runs one of the batch kernels directly
+ * @param avx2 param 6 use the AVX2 kernel instead of the scalar one
+ * @return false if the AVX2 kernel was asked for and is not available
+ */
+bool SpatialGrid::squared_distances(int const* x, int const* y, std::size_t n, Coord xy, std::uint64_t* out, bool avx2)
+{
+    if(!avx2){
+        squared_distances_scalar(x, y, n, xy, out);
+        return true;
+    }
+#ifdef DATASTRUCTURES_HAVE_AVX2
+    if(__builtin_cpu_supports("avx2")){
+        squared_distances_avx2(x, y, n, xy, out);
+        return true;
+    }
+#endif
+    return false;
+}
+/**
+ * @brief SpatialGrid::insert adds a station to the cell covering its coordinate
+ * @param xy param 1 coordinate of the station
+ * @param v param 2 station
+ */
+void SpatialGrid::insert(Coord xy, StationIndex v)
+{
+    std::int64_t cx = cell_of(xy.x);
+    std::int64_t cy = cell_of(xy.y);
+    Cell& cell = cells[key(cx, cy)];
+    cell.x.push_back(xy.x);
+    cell.y.push_back(xy.y);
+    cell.stations.push_back(v);
+    if(count == 0 && max_cx < min_cx){
+        min_cx = max_cx = cx;
+        min_cy = max_cy = cy;
+    }
+    min_cx = std::min(min_cx, cx);
+    max_cx = std::max(max_cx, cx);
+    min_cy = std::min(min_cy, cy);
+    max_cy = std::max(max_cy, cy);
+    if(++count > rebuild_at){rebuild();}
+}
+/**
+ * @brief SpatialGrid::erase removes a station from the cell covering its coordinate
+ * @param xy param 1 coordinate the station was inserted with
+ * @param v param 2 station
+ */
+void SpatialGrid::erase(Coord xy, StationIndex v)
+{
+    auto cell = cells.find(key(cell_of(xy.x), cell_of(xy.y)));
+    if(cell == cells.end()){return;}
+    Cell& entries = cell->second;
+    for(std::size_t i = 0; i < entries.stations.size(); ++i){
+        if(entries.stations[i] == v){
+            entries.x[i] = entries.x.back();
+            entries.y[i] = entries.y.back();
+            entries.stations[i] = entries.stations.back();
+            entries.x.pop_back();
+            entries.y.pop_back();
+            entries.stations.pop_back();
+            --count;
+            break;
+        }
+    }
+    if(entries.stations.empty()){cells.erase(cell);}
+}
+/**
+ * @brief SpatialGrid::clear removes every station from the grid
+ */
+void SpatialGrid::clear()
+{
+    *this = SpatialGrid();
+}
+/**
+ * @brief SpatialGrid::rebuild picks a new cell size from the bounding box and redistributes the stations
+ */
+void SpatialGrid::rebuild()
+{
+    std::vector<std::pair<Coord, StationIndex>> entries;
+    entries.reserve(count);
+    int min_x = std::numeric_limits<int>::max(), max_x = std::numeric_limits<int>::min();
+    int min_y = min_x, max_y = max_x;
+    for(auto const& cell : cells){
+        for(std::size_t i = 0; i < cell.second.stations.size(); ++i){
+            Coord xy{cell.second.x[i], cell.second.y[i]};
+            entries.push_back({xy, cell.second.stations[i]});
+            min_x = std::min(min_x, xy.x);
+            max_x = std::max(max_x, xy.x);
+            min_y = std::min(min_y, xy.y);
+            max_y = std::max(max_y, xy.y);
+        }
+    }
 
+    // Aim for about STATIONS_PER_CELL stations per cell over the bounding box
+    double width = std::max(1.0, double(max_x) - min_x);
+    double height = std::max(1.0, double(max_y) - min_y);
+    double size = std::sqrt(double(STATIONS_PER_CELL) * width * height / std::max<std::size_t>(1, entries.size()));
+
+    *this = SpatialGrid();
+    cell_size = std::max<std::int64_t>(1, static_cast<std::int64_t>(size));
+    rebuild_at = std::max<std::size_t>(64, 2 * entries.size());
+    cells.reserve(entries.size());
+    for(auto const& entry : entries){
+        insert(entry.first, entry.second);
+    }
+}
+/**
+ * @brief SpatialGrid::scan_cell offers every station of one cell to the k best hits kept as a max-heap
+ */
+void SpatialGrid::scan_cell(Cell const& entries, Coord xy, std::size_t k, std::vector<Hit>& best) const
+{
+    for_each_squared_distance(entries, xy, [&](std::size_t i, std::uint64_t d){
+        if(best.size() == k && d > best.front().first){return;}
+        Hit hit{d, entries.stations[i]};
+        if(best.size() < k){
+            best.push_back(hit);
+            std::push_heap(best.begin(), best.end());
+        }
+        else if(hit < best.front()){
+            std::pop_heap(best.begin(), best.end());
+            best.back() = hit;
+            std::push_heap(best.begin(), best.end());
+        }
+    });
+}
+/**
+ * @brief SpatialGrid::nearest finds the k closest stations by scanning rings of cells around xy
+ * @param xy param 1 query coordinate
+ * @param k param 2 number of stations wanted
+ * @param out param 3 receives the hits, closest first
+ */
+void SpatialGrid::nearest(Coord xy, std::size_t k, std::vector<Hit>& out) const
+{
+    out.clear();
+    if(k == 0 || count == 0){return;}
+    k = std::min(k, count);
+
+    std::int64_t qx = cell_of(xy.x);
+    std::int64_t qy = cell_of(xy.y);
+    // Rings closer than the bounding box are empty, rings past its far corner too
+    std::int64_t first = std::max({min_cx - qx, qx - max_cx, min_cy - qy, qy - max_cy, std::int64_t(0)});
+    std::int64_t last = std::max({qx - min_cx, max_cx - qx, qy - min_cy, max_cy - qy});
+    auto probe = [&](std::int64_t cx, std::int64_t cy){
+        auto cell = cells.find(key(cx, cy));
+        if(cell != cells.end()){scan_cell(cell->second, xy, k, out);}
+    };
+
+    std::size_t probed = 0;
+    for(std::int64_t r = first; r <= last; ++r){
+        if(out.size() == k && r > 0){
+            // Anything in ring r is at least (r - 1) whole cells away from xy
+            std::uint64_t reach = std::uint64_t(r - 1) * std::uint64_t(cell_size);
+            if(reach > std::numeric_limits<std::uint32_t>::max() || reach * reach > out.front().first){break;}
+        }
+        // Far apart stations leave most rings empty, once the rings cost more
+        // probes than there are occupied cells every cell is scanned instead
+        probed += r == 0 ? 1 : 8 * std::size_t(r);
+        if(probed > cells.size()){
+            out.clear();
+            for(auto const& cell : cells){scan_cell(cell.second, xy, k, out);}
+            break;
+        }
+        std::int64_t y_begin = std::max(qy - r, min_cy);
+        std::int64_t y_end = std::min(qy + r, max_cy);
+        for(std::int64_t cy = y_begin; cy <= y_end; ++cy){
+            if(cy == qy - r || cy == qy + r){
+                std::int64_t x_begin = std::max(qx - r, min_cx);
+                std::int64_t x_end = std::min(qx + r, max_cx);
+                for(std::int64_t cx = x_begin; cx <= x_end; ++cx){
+                    probe(cx, cy);
+                }
+            }
+            else{
+                if(qx - r >= min_cx){probe(qx - r, cy);}
+                if(r > 0 && qx + r <= max_cx){probe(qx + r, cy);}
+            }
+        }
+    }
+    std::sort_heap(out.begin(), out.end());
+}
+/**
+ * @brief SpatialGrid::within finds the stations inside a circle
+ * @param xy param 1 centre of the circle
+ * @param radius param 2 radius of the circle
+ * @param out param 3 receives the hits, closest first
+ */
+void SpatialGrid::within(Coord xy, Distance radius, std::vector<Hit>& out) const
+{
+    out.clear();
+    if(radius < 0 || count == 0){return;}
+    std::uint64_t limit = std::uint64_t(radius) * std::uint64_t(radius);
+
+    auto offer = [&](Cell const& entries){
+        for_each_squared_distance(entries, xy, [&](std::size_t i, std::uint64_t d){
+            if(d <= limit){out.push_back({d, entries.stations[i]});}
+        });
+    };
+
+    std::int64_t x_begin = std::max(cell_of(std::max<std::int64_t>(std::int64_t(xy.x) - radius, std::numeric_limits<int>::min())), min_cx);
+    std::int64_t x_end = std::min(cell_of(std::min<std::int64_t>(std::int64_t(xy.x) + radius, std::numeric_limits<int>::max())), max_cx);
+    std::int64_t y_begin = std::max(cell_of(std::max<std::int64_t>(std::int64_t(xy.y) - radius, std::numeric_limits<int>::min())), min_cy);
+    std::int64_t y_end = std::min(cell_of(std::min<std::int64_t>(std::int64_t(xy.y) + radius, std::numeric_limits<int>::max())), max_cy);
+
+    if(x_end < x_begin || y_end < y_begin){return;}
+    if((x_end - x_begin + 1) * (y_end - y_begin + 1) > std::int64_t(cells.size())){
+        // The circle covers more cells than are occupied, walk the occupied ones
+        for(auto const& cell : cells){offer(cell.second);}
+    }
+    else{
+        for(std::int64_t cy = y_begin; cy <= y_end; ++cy){
+            for(std::int64_t cx = x_begin; cx <= x_end; ++cx){
+                auto cell = cells.find(key(cx, cy));
+                if(cell == cells.end()){continue;}
+                offer(cell->second);
+            }
+        }
+    }
+    std::sort(out.begin(), out.end());
+}
+/**
+ * @brief NameIndex::before orders two stations by name and then by station id
+ * @param a param 1 station
+ * @param b param 2 station
+ * @return true if a comes before b
+ */
+bool NameIndex::before(StationIndex a, StationIndex b) const
+{
+    Station const& first = (*stations)[a];
+    Station const& second = (*stations)[b];
+    int order = std::string_view(first.name).compare(second.name);
+    return order < 0 || (order == 0 && first.id < second.id);
+}
+/**
+ * @brief NameIndex::block_for finds the block a station belongs in, the last one starting at or before it
+ * @param v param 1 the station looked for
+ * @return index of the block, 0 when the station is before every block
+ */
+std::size_t NameIndex::block_for(StationIndex v) const
+{
+    auto after = std::partition_point(blocks.begin(), blocks.end(), [&](std::vector<StationIndex> const& block){
+        return !before(v, block.front());
+    });
+    return after == blocks.begin() ? 0 : static_cast<std::size_t>(after - blocks.begin()) - 1;
+}
+/**
+ * @brief NameIndex::insert adds a station to its block and splits the block once it is full
+ * @param v param 1 station
+ */
+void NameIndex::insert(StationIndex v)
+{
+    ++count;
+    if(blocks.empty()){
+        blocks.emplace_back();
+        blocks.back().reserve(2 * BLOCK);
+        blocks.back().push_back(v);
+        return;
+    }
+    std::size_t b = block_for(v);
+    std::vector<StationIndex>& block = blocks[b];
+    block.insert(std::upper_bound(block.begin(), block.end(), v, [this](StationIndex x, StationIndex y){
+        return before(x, y);
+    }), v);
+    if(block.size() < 2 * BLOCK){return;}
+
+    std::vector<StationIndex> upper;
+    upper.reserve(2 * BLOCK);
+    upper.insert(upper.end(), block.begin() + BLOCK, block.end());
+    block.erase(block.begin() + BLOCK, block.end());
+    blocks.insert(blocks.begin() + b + 1, std::move(upper));
+}
+/**
+ * @brief NameIndex::insert_many adds many stations. A batch under a sixteenth of the index is inserted
+ * one by one, moving every entry to merge it would cost more. A larger batch is merged with every
+ * block into new blocks.
+ * @param added param 1 the new stations in any order
+ */
+void NameIndex::insert_many(std::vector<StationIndex> added)
+{
+    auto order = [this](StationIndex x, StationIndex y){ return before(x, y); };
+    std::sort(added.begin(), added.end(), order);
+    if(16 * added.size() < count){
+        for(auto v : added){insert(v);}
+        return;
+    }
+    std::vector<StationIndex> merged;
+    merged.reserve(count + added.size());
+    auto next = added.begin();
+    for(auto const& block : blocks){
+        for(auto v : block){
+            while(next != added.end() && before(*next, v)){merged.push_back(*next++);}
+            merged.push_back(v);
+        }
+    }
+    merged.insert(merged.end(), next, added.end());
+
+    blocks.clear();
+    for(std::size_t first = 0; first < merged.size(); first += BLOCK){
+        std::size_t last = std::min(merged.size(), first + BLOCK);
+        blocks.emplace_back();
+        blocks.back().reserve(2 * BLOCK);
+        blocks.back().insert(blocks.back().end(), merged.begin() + first, merged.begin() + last);
+    }
+    count = merged.size();
+}
+/**
+ * @brief NameIndex::erase removes a station from its block, dropping the block once it is empty
+ * @param v param 1 station, still holding the name and id it was inserted with
+ */
+void NameIndex::erase(StationIndex v)
+{
+    if(blocks.empty()){return;}
+    std::size_t b = block_for(v);
+    std::vector<StationIndex>& block = blocks[b];
+    auto it = std::partition_point(block.begin(), block.end(), [&](StationIndex x){ return before(x, v); });
+    if(it == block.end() || *it != v){return;}
+    block.erase(it);
+    --count;
+    if(block.empty()){blocks.erase(blocks.begin() + b);}
+}
+/**
+ * @brief NameIndex::renumber moves every entry to the new index of its station. Names and ids
+ * move with the stations, so the order stays valid.
+ * @param renumber param 1 new index of every old station index
+ */
+void NameIndex::renumber(std::vector<StationIndex> const& renumber)
+{
+    for(auto& block : blocks){
+        for(auto& v : block){v = renumber[v];}
+    }
+}
+/**
+ * @brief NameIndex::clear removes every station from the index
+ */
+void NameIndex::clear()
+{
+    blocks.clear();
+    count = 0;
+}
+/**
+ * @brief NameIndex::scan visits the entries in order from the start position until visit returns false
+ * @param from param 1 entries with a smaller name are skipped
+ * @param after_id param 2 when set, entries named from with an id up to *after_id are skipped too
+ * @param visit param 3 called with the station of every entry, returns whether to go on
+ */
+template<typename Visit>
+void NameIndex::scan(std::string_view from, StationID const* after_id, Visit visit) const
+{
+    auto skipped = [&](StationIndex v){
+        Station const& station = (*stations)[v];
+        int order = std::string_view(station.name).compare(from);
+        return order < 0 || (order == 0 && after_id != nullptr && station.id <= *after_id);
+    };
+    // First block that does not end before the start
+    auto block = std::partition_point(blocks.begin(), blocks.end(), [&](std::vector<StationIndex> const& entries){
+        return skipped(entries.back());
+    });
+    if(block == blocks.end()){return;}
+    for(auto it = std::partition_point(block->begin(), block->end(), skipped); it != block->end(); ++it){
+        if(!visit((*stations)[*it])){return;}
+    }
+    for(++block; block != blocks.end(); ++block){
+        for(auto v : *block){
+            if(!visit((*stations)[v])){return;}
+        }
+    }
+}
+/**
+ * @brief NameIndex::page lists up to count stations in name order from a start position
+ * @param from param 1 first name of the page
+ * @param after_id param 2 when set, the page starts right after this station among those named from
+ * @param count param 3 most stations listed
+ * @param out param 4 the ids are appended to it
+ */
+void NameIndex::page(std::string_view from, StationID const* after_id, std::size_t count, std::vector<StationID>& out) const
+{
+    if(count == 0){return;}
+    std::size_t taken = 0;
+    scan(from, after_id, [&](Station const& station){
+        out.push_back(station.id);
+        return ++taken < count;
+    });
+}
+/**
+ * @brief NameIndex::with_prefix lists up to limit stations whose name starts with prefix, in name order
+ * @param prefix param 1 start of the names
+ * @param limit param 2 most stations listed
+ * @param out param 3 the ids are appended to it
+ */
+void NameIndex::with_prefix(std::string_view prefix, std::size_t limit, std::vector<StationID>& out) const
+{
+    if(limit == 0){return;}
+    std::size_t taken = 0;
+    scan(prefix, nullptr, [&](Station const& station){
+        if(std::string_view(station.name).substr(0, prefix.size()) != prefix){return false;}
+        out.push_back(station.id);
+        return ++taken < limit;
+    });
+}
+/**
+ * @brief NameIndex::for_each visits the ids in name order, skipping whole blocks up to the offset
+ * @param offset param 1 entries skipped first
+ * @param limit param 2 most entries visited
+ * @param visit param 3 called with every id, returns whether to go on
+ * @return number of entries visited
+ */
+std::size_t NameIndex::for_each(std::size_t offset, std::size_t limit, std::function<bool(std::string_view)> const& visit) const
+{
+    std::size_t visited = 0;
+    if(limit == 0){return visited;}
+    for(auto const& block : blocks){
+        if(offset >= block.size()){
+            offset -= block.size();
+            continue;
+        }
+        for(auto it = block.begin() + offset; it != block.end(); ++it){
+            ++visited;
+            if(!visit((*stations)[*it].id) || visited == limit){return visited;}
+        }
+        offset = 0;
+    }
+    return visited;
+}
+/**
+ * @brief Datastructures::route_earliest_arrival finds the journey that arrives first using the connection scan algorithm
+ * @param fromid param 1 starting station
+ * @param toid param 2 destination station
+ * @param departure_time param 3 earliest time the journey may leave
+ * @return (station, train taken from it, time) for every stop, the last entry is the arrival at toid
+ */
+std::vector<std::tuple<StationID, TrainID, Time>> Datastructures::route_earliest_arrival(StationID fromid, StationID toid, Time departure_time)
+{
+    OPERATION_METRICS(route_earliest_arrival);
+    StationIndex from = find_station(fromid);
+    StationIndex to = find_station(toid);
+    if(from == NO_INDEX || to == NO_INDEX){return {std::make_tuple(NO_STATION, NO_TRAIN, NO_TIME)};}
+    if(from == to){return {std::make_tuple(fromid, NO_TRAIN, departure_time)};}
+
+    auto const& hops = connections();
+    SearchWorkspace& ws = SearchWorkspace::for_thread();
+    if(!scan_connections(hops, stations.size(), trains.size(), from, to, departure_time, ws)){return {};}
+    return build_journey(hops, ws, from, to, [this](StationIndex v){ return stations[v].id; },
+                         [this](TrainIndex t){ return train_ids[t]; });
+}
+/**
+ * @brief Datastructures::route_pareto finds the journeys that trade arrival time against transfers using RAPTOR
+ * @param fromid param 1 starting station
+ * @param toid param 2 destination station
+ * @param departure_time param 3 earliest time the journey may leave
+ * @param max_transfers param 4 most train changes allowed
+ * @return pareto optimal journeys with fewest transfers first, each in the same
+ * format as route_earliest_arrival
+ */
+std::vector<std::vector<std::tuple<StationID, TrainID, Time>>> Datastructures::route_pareto(StationID fromid, StationID toid, Time departure_time, unsigned int max_transfers)
+{
+    OPERATION_METRICS(route_pareto);
+    using Journey = std::vector<std::tuple<StationID, TrainID, Time>>;
+    StationIndex from = find_station(fromid);
+    StationIndex to = find_station(toid);
+    if(from == NO_INDEX || to == NO_INDEX){return {Journey{std::make_tuple(NO_STATION, NO_TRAIN, NO_TIME)}};}
+    if(from == to){return {Journey{std::make_tuple(fromid, NO_TRAIN, departure_time)}};}
+
+    // How a station was improved in a round. previous is the label the station had
+    // before, NO_INDEX for the departure station and stations first reached
+    struct Label{
+        int arrival;
+        std::uint32_t round;
+        std::uint32_t previous;
+        std::uint32_t pattern;
+        std::uint32_t trip;
+        std::uint32_t board;
+        std::uint32_t alight;
+    };
+    const int unreached = std::numeric_limits<int>::max();
+    const std::size_t n = stations.size();
+    const RoutePatterns& rp = patterns();
+
+    // A station is reached once it has an arrival of an earlier round in ws.distance
+    // and ws.parent is its newest label. It is settled while it is marked in this round,
+    // then its newest label is from this round and its arrival is not yet committed.
+    SearchWorkspace& ws = SearchWorkspace::for_thread();
+    ws.start(n);
+    if(ws.first_stop.size() < rp.pattern_count()){ws.first_stop.resize(rp.pattern_count(), NO_INDEX);}
+    ws.marked.clear();
+    std::vector<Label> labels;
+    auto best = [&](StationIndex v){
+        if(ws.is_settled(v)){return labels[ws.parent[v]].arrival;}
+        return ws.is_reached(v) ? ws.distance[v] : unreached;
+    };
+    // Newest label of v from round k or earlier, NO_INDEX when v was not reached by then
+    auto label_at = [&](StationIndex v, std::size_t k){
+        std::uint32_t l = ws.parent[v];
+        while(l != NO_INDEX && labels[l].round > k){l = labels[l].previous;}
+        return l;
+    };
+
+    ws.reach(from, NO_INDEX);
+    ws.distance[from] = departure_time;
+    ws.marked.push_back(from);
+
+    // A journey worth keeping boards at most one trip per station, so more than
+    // n rounds never help and a huge transfer cap costs no extra labels
+    const std::size_t round_limit = std::min<std::size_t>(max_transfers, n) + 1;
+    std::size_t rounds = 0;
+    for(std::size_t k = 1; k <= round_limit && !ws.marked.empty(); ++k){
+        rounds = k;
+        ws.patterns.clear();
+        SEARCH_EXPANDED(ws.marked.size());
+        for(auto v : ws.marked){
+            ws.settled[v] = 0;
+            // Stations added after the patterns were built are not on any pattern
+            if(v + 1 >= rp.station_begin.size()){continue;}
+            for(auto i = rp.station_begin[v]; i < rp.station_begin[v + 1]; ++i){
+                auto const& sp = rp.station_patterns[i];
+                if(ws.first_stop[sp.first] == NO_INDEX){ws.patterns.push_back(sp.first);}
+                if(sp.second < ws.first_stop[sp.first]){ws.first_stop[sp.first] = sp.second;}
+            }
+        }
+        ws.marked.clear();
+
+        for(auto r : ws.patterns){
+            std::uint32_t p0 = ws.first_stop[r];
+            ws.first_stop[r] = NO_INDEX;
+            std::uint32_t trip = NO_INDEX;
+            std::uint32_t board = 0;
+            for(std::uint32_t p = p0; p < rp.stop_count(r); ++p){
+                StationIndex v = rp.stops[rp.stop_begin[r] + p];
+                if(trip != NO_INDEX){
+                    int t = rp.time(r, trip, p);
+                    if(t < std::min(best(v), best(to))){
+                        Label label{t, static_cast<std::uint32_t>(k), NO_INDEX, r, trip, board, p};
+                        if(ws.is_settled(v)){
+                            label.previous = labels[ws.parent[v]].previous;
+                            labels[ws.parent[v]] = label;
+                        }
+                        else{
+                            label.previous = ws.is_reached(v) ? ws.parent[v] : NO_INDEX;
+                            ws.parent[v] = static_cast<std::uint32_t>(labels.size());
+                            labels.push_back(label);
+                            ws.settle(v);
+                            ws.marked.push_back(v);
+                        }
+                    }
+                }
+                // Boarding uses the arrival of the previous round only
+                int ready = ws.is_reached(v) ? ws.distance[v] : unreached;
+                if(ready == unreached || (trip != NO_INDEX && ready > rp.time(r, trip, p))){continue;}
+                // Earliest trip leaving at or after ready, trips are in time order at every stop
+                std::uint32_t lo = 0;
+                std::uint32_t hi = trip == NO_INDEX ? rp.trip_count(r) : trip;
+                while(lo < hi){
+                    std::uint32_t mid = (lo + hi) / 2;
+                    if(rp.time(r, mid, p) < ready){lo = mid + 1;} else{hi = mid;}
+                }
+                if(lo < (trip == NO_INDEX ? rp.trip_count(r) : trip)){trip = lo; board = p;}
+            }
+        }
+        // Commit the arrivals of this round for the next one
+        for(auto v : ws.marked){
+            ws.reached[v] = ws.epoch;
+            ws.distance[v] = labels[ws.parent[v]].arrival;
+        }
+    }
+
+    std::vector<Journey> result;
+    if(!ws.is_reached(to)){return result;}
+    int previous_best = unreached;
+    for(std::size_t k = 1; k <= rounds; ++k){
+        std::uint32_t last = label_at(to, k);
+        if(last == NO_INDEX){continue;}
+        int arrival = labels[last].arrival;
+        if(arrival >= previous_best){continue;}
+        previous_best = arrival;
+
+        // Walk the legs back to fromid, each leg boards at a label of an earlier round
+        std::vector<Label> legs;
+        for(std::uint32_t l = last; l != NO_INDEX;){
+            Label const& leg = labels[l];
+            legs.push_back(leg);
+            StationIndex v = rp.stops[rp.stop_begin[leg.pattern] + leg.board];
+            l = v == from ? NO_INDEX : label_at(v, leg.round - 1);
+        }
+
+        Journey journey;
+        for(auto leg = legs.rbegin(); leg != legs.rend(); ++leg){
+            TrainIndex train = rp.trips[rp.trip_begin[leg->pattern] + leg->trip];
+            for(auto p = leg->board; p < leg->alight; ++p){
+                journey.push_back(std::make_tuple(stations[rp.stops[rp.stop_begin[leg->pattern] + p]].id,
+                                                  train_ids[train], rp.time(leg->pattern, leg->trip, p)));
+            }
+        }
+        journey.push_back(std::make_tuple(toid, NO_TRAIN, static_cast<Time>(arrival)));
+        result.push_back(std::move(journey));
+    }
+    return result;
+}
+/**
+ * @brief Datastructures::regions_containing finds the regions whose polygon contains a coordinate
+ * @param xy param 1 coordinate
+ * @return vector of regionids in increasing order
+ */
+std::vector<RegionID> Datastructures::regions_containing(Coord xy)
+{
+    OPERATION_METRICS(regions_containing);
+    std::vector<RegionRTree::Entry const*> hits;
+    regions_spatial().containing(xy, hits);
+
+    std::vector<RegionID> result;
+    result.reserve(hits.size());
+    for(auto hit : hits){result.push_back(hit->region->id);}
+    std::sort(result.begin(), result.end());
+    return result;
+}
+/**
+ * @brief Datastructures::assign_stations_to_regions_by_geometry puts every station into the most
+ * specific region whose polygon contains it: the deepest one in the hierarchy, then the smallest.
+ * Stations outside every polygon keep their current region.
+ * @return number of stations assigned
+ */
+unsigned int Datastructures::assign_stations_to_regions_by_geometry()
+{
+    OPERATION_METRICS(assign_stations_to_regions_by_geometry);
+    const RegionRTree& tree = regions_spatial();
+    regions_indexed();
+
+    unsigned int assigned = 0;
+    std::vector<RegionRTree::Entry const*> hits;
+    for(StationIndex v = 0; v < stations.size(); ++v){
+        if(stations[v].removed){continue;}
+        tree.containing(station_columns.coord(v), hits);
+        RegionRTree::Entry const* best = nullptr;
+        for(auto hit : hits){
+            if(best == nullptr){best = hit; continue;}
+            // A containing region inside the current best one is more specific
+            if(RegionForest::is_ancestor(*best->region, *hit->region)
+                    || (!RegionForest::is_ancestor(*hit->region, *best->region) && hit->area < best->area)){
+                best = hit;
+            }
+        }
+        if(best != nullptr){
+            station_columns.region[v] = best->region;
+            ++assigned;
+        }
+    }
+    return assigned;
+}
+/**
+ * @brief Datastructures::regions_spatial returns the R-tree over region polygons, building it if regions were added
+ * @return region R-tree
+ */
+const RegionRTree& Datastructures::regions_spatial()
+{
+    if(!region_tree_valid){
+        region_tree.build(regions_map);
+        region_tree_valid = true;
+    }
+    return region_tree;
+}
+/**
+ * @brief RegionRTree::build bulk loads the tree from every region with a polygon
+ * @param regions param 1 all regions
+ */
+void RegionRTree::build(RegionMap& regions)
+{
+    entries.clear();
+    nodes.clear();
+    for(auto& entry : regions){
+        auto const& polygon = entry.second.coord;
+        if(polygon.size() < 3){continue;}
+        Box box;
+        double twice_area = 0;
+        for(std::size_t i = 0, j = polygon.size() - 1; i < polygon.size(); j = i++){
+            box.extend(polygon[i]);
+            twice_area += double(polygon[j].x) * polygon[i].y - double(polygon[i].x) * polygon[j].y;
+        }
+        entries.push_back(Entry{box, &entry.second, std::abs(twice_area) / 2});
+    }
+    if(entries.empty()){return;}
+
+    str_order(entries, [](Entry const& e) -> Box const& { return e.box; });
+    std::vector<Node> level;
+    for(std::uint32_t first = 0; first < entries.size(); first += FANOUT){
+        Node leaf{Box(), first, std::min<std::uint32_t>(FANOUT, entries.size() - first), true};
+        for(auto i = first; i < first + leaf.count; ++i){leaf.box.extend(entries[i].box);}
+        level.push_back(leaf);
+    }
+
+    while(true){
+        str_order(level, [](Node const& n) -> Box const& { return n.box; });
+        std::uint32_t base = static_cast<std::uint32_t>(nodes.size());
+        nodes.insert(nodes.end(), level.begin(), level.end());
+        if(level.size() == 1){break;}
+
+        std::vector<Node> parents;
+        for(std::uint32_t first = 0; first < level.size(); first += FANOUT){
+            Node parent{Box(), base + first, std::min<std::uint32_t>(FANOUT, level.size() - first), false};
+            for(auto i = first; i < first + parent.count; ++i){parent.box.extend(level[i].box);}
+            parents.push_back(parent);
+        }
+        level = std::move(parents);
+    }
+}
+/**
+ * @brief RegionRTree::containing descends into every node whose box holds xy and tests the polygons of the leaves
+ * @param xy param 1 coordinate
+ * @param out param 2 receives the entries whose polygon contains xy
+ */
+void RegionRTree::containing(Coord xy, std::vector<Entry const*>& out) const
+{
+    out.clear();
+    if(nodes.empty()){return;}
+
+    // Each level pushes at most FANOUT children, enough for any 32 bit entry count
+    std::uint32_t stack[16 * FANOUT];
+    std::size_t depth = 0;
+    stack[depth++] = static_cast<std::uint32_t>(nodes.size() - 1);
+    while(depth > 0){
+        Node const& node = nodes[stack[--depth]];
+        if(!node.box.contains(xy)){continue;}
+        for(auto i = node.first; i < node.first + node.count; ++i){
+            if(node.leaf){
+                if(entries[i].box.contains(xy) && polygon_contains(entries[i].region->coord, xy)){
+                    out.push_back(&entries[i]);
+                }
+            }
+            else if(nodes[i].box.contains(xy)){
+                stack[depth++] = i;
+            }
+        }
+    }
+}
+/**
+ * @brief Datastructures::add_stations_bulk adds many stations at once, stations whose id is already taken are skipped
+ * @param new_stations param 1 (id, name, coordinates) of every station
+ * @return number of stations added
+ */
+unsigned int Datastructures::add_stations_bulk(std::vector<std::tuple<StationID, Name, Coord>> new_stations)
+{
+    OPERATION_METRICS(add_stations_bulk);
+    stations.reserve(stations.size() + new_stations.size());
+    station_columns.reserve(stations.size() + new_stations.size());
+    station_lookup.reserve(station_lookup.size() + new_stations.size());
+
+    std::vector<StationIndex> added;
+    added.reserve(new_stations.size());
+    for(auto& entry : new_stations){
+        StationIndex index = static_cast<StationIndex>(stations.size());
+        if(!station_lookup.emplace(std::get<0>(entry), index).second){continue;}
+        append_station(std::move(std::get<0>(entry)), std::get<1>(entry), std::get<2>(entry));
+        station_grid.insert(std::get<2>(entry), index);
+        added.push_back(index);
+    }
+    unsigned int count = static_cast<unsigned int>(added.size());
+    index_stations(std::move(added));
+    return count;
+}
+/**
+ * @brief Datastructures::index_stations inserts new stations into the ordered name and coordinate indexes.
+ * The names are merged into the name index at once. The coordinates get one sort, then every insert
+ * lands right after the previous one. The stable sort keeps the later of two equal coordinates winning,
+ * like add_station.
+ * @param added param 1 the new stations in the order they were added
+ */
+void Datastructures::index_stations(std::vector<StationIndex> added)
+{
+    stations_sorted.insert_many(added);
+    std::stable_sort(added.begin(), added.end(), [this](StationIndex a, StationIndex b){
+        return CoordComparator()(station_columns.coord(a), station_columns.coord(b));
+    });
+    auto coord_hint = coord_map.end();
+    for(auto index : added){
+        coord_hint = std::next(coord_map.insert_or_assign(coord_hint, station_columns.coord(index), index));
+    }
+    stations_changed = true;
+}
+/**
+ * @brief Datastructures::add_regions_bulk adds many regions at once, regions whose id is already taken are skipped
+ * @param new_regions param 1 (id, name, polygon) of every region
+ * @return number of regions added
+ */
+unsigned int Datastructures::add_regions_bulk(std::vector<std::tuple<RegionID, Name, std::vector<Coord>>> new_regions)
+{
+    OPERATION_METRICS(add_regions_bulk);
+    regions_map.reserve(regions_map.size() + new_regions.size());
+
+    unsigned int added = 0;
+    for(auto& entry : new_regions){
+        RegionID id = std::get<0>(entry);
+        auto inserted = regions_map.emplace(id, new_region(id, std::get<1>(entry), std::get<2>(entry)));
+        if(inserted.second){++added;}
+    }
+    if(added > 0){
+        region_forest_valid = false;
+        region_tree_valid = false;
+    }
+    return added;
+}
+/**
+ * @brief Datastructures::add_trains_bulk adds many trains at once, trains rejected by add_train are skipped
+ * @param new_trains param 1 (trainid, stationtimes) of every train
+ * @return number of trains added
+ */
+unsigned int Datastructures::add_trains_bulk(std::vector<std::pair<TrainID, std::vector<std::pair<StationID, Time>>>> new_trains)
+{
+    OPERATION_METRICS(add_trains_bulk);
+    std::vector<TrainIndex> added;
+    added.reserve(new_trains.size());
+
+    for(auto& entry : new_trains){
+        TrainIndex existing = find_train(entry.first);
+        if((existing != NO_INDEX && trains[existing].added) || entry.second.empty()){continue;}
+
+        std::vector<std::pair<StationIndex, Time>> stops;
+        stops.reserve(entry.second.size());
+        for(auto const& stop : entry.second){
+            StationIndex index = find_station(stop.first);
+            if(index == NO_INDEX){break;}
+            stops.push_back(std::make_pair(index, stop.second));
+        }
+        if(stops.size() != entry.second.size()){continue;}
+
+        TrainIndex train = intern_train(entry.first);
+        trains[train].stationtimes.assign(stops.begin(), stops.end());
+        trains[train].added = true;
+        added.push_back(train);
+    }
+    unsigned int count = static_cast<unsigned int>(added.size());
+    link_trains(added);
+    return count;
+}
+/**
+ * @brief Datastructures::link_trains adds the adjacency and departures of newly stored trains
+ * @param added param 1 trains whose stops are stored but not linked yet
+ */
+void Datastructures::link_trains(std::vector<TrainIndex> const& added)
+{
+    if(added.empty()){return;}
+    std::vector<std::uint32_t> new_edges(stations.size(), 0);
+    for(auto train : added){
+        auto const& stops = trains[train].stationtimes;
+        for(std::size_t i = 0; i + 1 < stops.size(); ++i){++new_edges[stops[i].first];}
+    }
+
+    // Presize every touched station once, then fill adjacency and departures in one pass
+    std::vector<std::uint32_t> old_departures(stations.size(), 0);
+    for(StationIndex v = 0; v < stations.size(); ++v){
+        if(new_edges[v] == 0){continue;}
+        old_departures[v] = static_cast<std::uint32_t>(stations[v].departures.size());
+        stations[v].neighbours.reserve(stations[v].neighbours.size() + new_edges[v]);
+        stations[v].neighbour_weights.reserve(stations[v].neighbours.size() + new_edges[v]);
+        stations[v].departures.reserve(stations[v].departures.size() + new_edges[v]);
+    }
+    for(auto train : added){
+        auto const& stops = trains[train].stationtimes;
+        for(std::size_t i = 0; i + 1 < stops.size(); ++i){
+            add_edge(stops[i].first, stops[i + 1].first);
+            stations[stops[i].first].departures.push_back(std::make_pair(stops[i].second, train));
+        }
+        index_train_stops(train);
+    }
+
+    auto by_time = [](std::pair<Time, TrainIndex> const& a, std::pair<Time, TrainIndex> const& b){ return a.first < b.first; };
+    for(StationIndex v = 0; v < stations.size(); ++v){
+        if(new_edges[v] == 0){continue;}
+        auto& departures = stations[v].departures;
+        departures_changed(v);
+        auto middle = departures.begin() + old_departures[v];
+        std::stable_sort(middle, departures.end(), by_time);
+        std::inplace_merge(departures.begin(), middle, departures.end(), by_time);
+    }
+    invalidate_network();
+}
+/**
+ * @brief Datastructures::save_snapshot writes the whole network into a flat binary file.
+ * Removed stations are left out and the remaining ones renumbered densely.
+ * @param path param 1 file to write
+ * @return true if the file was written
+ */
+bool Datastructures::save_snapshot(std::string const& path)
+{
+    OPERATION_METRICS(save_snapshot);
+    const Graph& g = graph();
+    const RegionForest& forest = regions_indexed();
+
+    // Dense numbering of the live stations
+    std::vector<StationIndex> renumber(stations.size(), NO_INDEX);
+    std::vector<StationIndex> live;
+    live.reserve(station_lookup.size());
+    for(StationIndex v = 0; v < stations.size(); ++v){
+        if(stations[v].removed){continue;}
+        renumber[v] = static_cast<StationIndex>(live.size());
+        live.push_back(v);
+    }
+
+    // Regions in preorder so child lists come back in the same order
+    std::vector<RegionID> region_id;
+    std::vector<std::uint32_t> parent_index;
+    std::vector<std::uint32_t> coord_offsets{0};
+    std::vector<Coord> polygon_coords;
+    for(Region const* region : forest.order){
+        region_id.push_back(region->id);
+        parent_index.push_back(region->parent != nullptr ? region->parent->tin : NO_INDEX);
+        polygon_coords.insert(polygon_coords.end(), region->coord.begin(), region->coord.end());
+        coord_offsets.push_back(static_cast<std::uint32_t>(polygon_coords.size()));
+    }
+
+    std::vector<Coord> coords;
+    std::vector<std::uint32_t> membership;
+    std::vector<std::uint32_t> csr_offsets{0};
+    std::vector<StationIndex> csr_targets;
+    std::vector<Distance> csr_weights;
+    std::vector<std::uint32_t> departure_index{0};
+    std::vector<SnapshotDeparture> departures;
+    for(auto v : live){
+        Station const& station = stations[v];
+        Region const* region = station_columns.region[v];
+        coords.push_back(station_columns.coord(v));
+        membership.push_back(region != nullptr ? region->tin : NO_INDEX);
+        for(auto e = g.edges_begin(v); e != g.edges_end(v); ++e){
+            csr_targets.push_back(renumber[g.targets[e]]);
+            csr_weights.push_back(g.weights[e]);
+        }
+        csr_offsets.push_back(static_cast<std::uint32_t>(csr_targets.size()));
+        for(auto const& departure : station.departures){
+            departures.push_back(SnapshotDeparture{departure.second, departure.first, 0});
+        }
+        departure_index.push_back(static_cast<std::uint32_t>(departures.size()));
+    }
+
+    std::vector<std::uint8_t> added;
+    std::vector<std::uint32_t> stop_offsets{0};
+    std::vector<SnapshotStop> stops;
+    for(auto const& train : trains){
+        added.push_back(train.added);
+        for(auto const& stop : train.stationtimes){
+            if(renumber[stop.first] == NO_INDEX){continue;}
+            stops.push_back(SnapshotStop{renumber[stop.first], stop.second, 0});
+        }
+        stop_offsets.push_back(static_cast<std::uint32_t>(stops.size()));
+    }
+
+    SnapshotWriter writer(path);
+    writer.section(station_coords, coords);
+    writer.strings(station_id_offsets, station_id_chars, live, [this](StationIndex v) -> std::string_view { return stations[v].id; });
+    writer.strings(station_name_offsets, station_name_chars, live, [this](StationIndex v) -> std::string_view { return stations[v].name; });
+    writer.section(station_region, membership);
+    writer.section(graph_offsets, csr_offsets);
+    writer.section(graph_targets, csr_targets);
+    writer.section(graph_weights, csr_weights);
+    writer.section(graph_scale, std::vector<double>{g.heuristic_scale});
+    writer.section(departure_offsets, departure_index);
+    writer.section(departure_entries, departures);
+    writer.strings(train_id_offsets, train_id_chars, train_ids, [](TrainID const& id) -> std::string const& { return id; });
+    writer.section(train_added, added);
+    writer.section(train_stop_offsets, stop_offsets);
+    writer.section(train_stops, stops);
+    writer.section(region_ids, region_id);
+    writer.section(region_parent, parent_index);
+    writer.strings(region_name_offsets, region_name_chars, forest.order, [](Region const* r) -> std::string_view { return r->name; });
+    writer.section(region_coord_offsets, coord_offsets);
+    writer.section(region_coords, polygon_coords);
+    return writer.finish();
+}
+/**
+ * @brief Datastructures::load_snapshot replaces the whole network with the contents of a snapshot file.
+ * The file is mapped read-only and its arrays are copied straight into place, the CSR graph is
+ * installed as is instead of being rebuilt from the adjacency lists.
+ * @param path param 1 file written by save_snapshot
+ * @return true if the file was a valid snapshot, on false the datastructure is left empty
+ */
+bool Datastructures::load_snapshot(std::string const& path)
+{
+    OPERATION_METRICS(load_snapshot);
+    clear_all();
+    SnapshotFile file(path);
+    if(!file.valid()){return false;}
+
+    // Check that every table agrees on the counts before touching anything
+    std::size_t n = file.count<Coord>(station_coords);
+    std::size_t t = file.count<std::uint8_t>(train_added);
+    std::size_t r = file.count<RegionID>(region_ids);
+    std::size_t e = file.count<StationIndex>(graph_targets);
+    if(n == NO_INDEX || r == NO_INDEX || e == NO_INDEX){return false;}
+    if(!file.strings_valid(station_id_offsets, station_id_chars, n)
+            || !file.strings_valid(station_name_offsets, station_name_chars, n)
+            || !file.strings_valid(train_id_offsets, train_id_chars, t)
+            || !file.strings_valid(region_name_offsets, region_name_chars, r)){return false;}
+    if(file.count<std::uint32_t>(station_region) != n || file.count<Distance>(graph_weights) != e
+            || file.count<double>(graph_scale) != 1 || file.count<std::uint32_t>(region_parent) != r){return false;}
+    if(file.count<std::uint32_t>(graph_offsets) != n + 1 || file.count<std::uint32_t>(departure_offsets) != n + 1
+            || file.count<std::uint32_t>(train_stop_offsets) != t + 1 || file.count<std::uint32_t>(region_coord_offsets) != r + 1){return false;}
+    std::size_t d = file.count<SnapshotDeparture>(departure_entries);
+    std::size_t st = file.count<SnapshotStop>(train_stops);
+    std::size_t rc = file.count<Coord>(region_coords);
+    if(!offsets_valid(file.get<std::uint32_t>(graph_offsets), n + 1, e)
+            || !offsets_valid(file.get<std::uint32_t>(departure_offsets), n + 1, d)
+            || !offsets_valid(file.get<std::uint32_t>(train_stop_offsets), t + 1, st)
+            || !offsets_valid(file.get<std::uint32_t>(region_coord_offsets), r + 1, rc)){return false;}
+
+    auto targets = file.get<StationIndex>(graph_targets);
+    auto weights = file.get<Distance>(graph_weights);
+    auto parents = file.get<std::uint32_t>(region_parent);
+    auto memberships = file.get<std::uint32_t>(station_region);
+    auto departures = file.get<SnapshotDeparture>(departure_entries);
+    auto stops = file.get<SnapshotStop>(train_stops);
+    bool consistent = std::all_of(targets, targets + e, [n](StationIndex v){ return v < n; })
+            && std::all_of(memberships, memberships + n, [r](std::uint32_t i){ return i == NO_INDEX || i < r; })
+            && std::all_of(departures, departures + d, [t](SnapshotDeparture const& x){ return x.train < t; })
+            && std::all_of(stops, stops + st, [n](SnapshotStop const& x){ return x.station < n; });
+    for(std::size_t i = 0; i < r && consistent; ++i){
+        // Preorder puts every parent before its children
+        consistent = parents[i] == NO_INDEX || parents[i] < i;
+    }
+    if(!consistent){return false;}
+
+    // Regions first so stations can point at them
+    std::vector<Region*> region_at(r);
+    auto polygon_offsets = file.get<std::uint32_t>(region_coord_offsets);
+    auto polygons = file.get<Coord>(region_coords);
+    regions_map.reserve(r);
+    for(std::size_t i = 0; i < r; ++i){
+        RegionID id = file.get<RegionID>(region_ids)[i];
+        std::vector<Coord> polygon(polygons + polygon_offsets[i], polygons + polygon_offsets[i + 1]);
+        auto inserted = regions_map.emplace(id, new_region(id, file.string(region_name_offsets, region_name_chars, i), polygon));
+        if(!inserted.second){clear_all(); return false;}
+        region_at[i] = &inserted.first->second;
+        if(parents[i] != NO_INDEX){
+            region_at[i]->parent = region_at[parents[i]];
+            region_at[parents[i]]->children.push_back(region_at[i]);
+        }
+    }
+
+    auto coords = file.get<Coord>(station_coords);
+    auto csr_offsets = file.get<std::uint32_t>(graph_offsets);
+    auto dep_offsets = file.get<std::uint32_t>(departure_offsets);
+    stations.reserve(n);
+    station_columns.reserve(n);
+    station_lookup.reserve(n);
+    std::vector<StationIndex> added;
+    added.reserve(n);
+    for(StationIndex v = 0; v < n; ++v){
+        StationID id = file.string(station_id_offsets, station_id_chars, v);
+        if(!station_lookup.emplace(id, v).second){clear_all(); return false;}
+        Region* region = memberships[v] != NO_INDEX ? region_at[memberships[v]] : nullptr;
+        append_station(std::move(id), file.string(station_name_offsets, station_name_chars, v), coords[v]);
+        station_columns.region.back() = region;
+        stations.back().neighbours.assign(targets + csr_offsets[v], targets + csr_offsets[v + 1]);
+        stations.back().neighbour_weights.assign(weights + csr_offsets[v], weights + csr_offsets[v + 1]);
+        auto& station_departures = stations.back().departures;
+        station_departures.reserve(dep_offsets[v + 1] - dep_offsets[v]);
+        for(auto i = dep_offsets[v]; i < dep_offsets[v + 1]; ++i){
+            station_departures.push_back(std::make_pair(departures[i].time, departures[i].train));
+        }
+        station_grid.insert(coords[v], v);
+        added.push_back(v);
+    }
+    index_stations(std::move(added));
+
+    auto stop_offsets = file.get<std::uint32_t>(train_stop_offsets);
+    train_ids.reserve(t);
+    trains.reserve(t);
+    train_lookup.reserve(t);
+    for(TrainIndex i = 0; i < t; ++i){
+        TrainID id = file.string(train_id_offsets, train_id_chars, i);
+        if(!train_lookup.emplace(id, i).second){clear_all(); return false;}
+        train_ids.push_back(std::move(id));
+        Train train = new_train();
+        train.added = file.get<std::uint8_t>(train_added)[i] != 0;
+        for(auto s = stop_offsets[i]; s < stop_offsets[i + 1]; ++s){
+            train.stationtimes.push_back(std::make_pair(stops[s].station, stops[s].time));
+        }
+        trains.push_back(std::move(train));
+    }
+
+    auto snapshot = std::make_shared<Graph>();
+    snapshot->offsets.assign(csr_offsets, csr_offsets + n + 1);
+    snapshot->targets.assign(targets, targets + e);
+    snapshot->weights.assign(weights, weights + e);
+    snapshot->heuristic_scale = file.get<double>(graph_scale)[0];
+    heuristic_scale = snapshot->heuristic_scale;
+    for(StationIndex v = 0; v < n; ++v){
+        for(auto next : stations[v].neighbours){stations[next].predecessors.push_back(v);}
+    }
+    for(TrainIndex i = 0; i < t; ++i){index_train_stops(i);}
+    graph_snapshot = std::move(snapshot);
+    return true;
+}
+
+namespace
+{
+// Offset and limit bookkeeping of the for_each listings
+class Paging{
+public:
+    Paging(std::size_t offset, std::size_t limit) : skip(offset), limit(limit) {}
+    // Whether no more ids are wanted
+    bool done() const{ return stopped || visited == limit; }
+    // Ids up to the offset are skipped, the rest are visited
+    template<typename Id, typename Visit>
+    void offer(Id const& id, Visit const& visit){
+        if(skip > 0){
+            --skip;
+            return;
+        }
+        ++visited;
+        stopped = !visit(id);
+    }
+    std::size_t count() const{ return visited; }
+
+private:
+    std::size_t skip;
+    std::size_t limit;
+    std::size_t visited = 0;
+    bool stopped = false;
+};
+}
+/**
+ * @brief Datastructures::for_each_station visits the stations in the unspecified order of the station array,
+ * without copying the ids
+ * @param visit param 1 called with every id, returns whether to go on
+ * @param offset param 2 stations skipped first
+ * @param limit param 3 most stations visited
+ * @return number of stations visited
+ */
+std::size_t Datastructures::for_each_station(StationVisitor const& visit, std::size_t offset, std::size_t limit)
+{
+    OPERATION_METRICS(for_each_station);
+    Paging page(offset, limit);
+    for(std::size_t v = 0; v < stations.size() && !page.done(); ++v){
+        if(!stations[v].removed){page.offer(std::string_view(stations[v].id), visit);}
+    }
+    return page.count();
+}
+/**
+ * @brief Datastructures::for_each_station_alphabetically visits the stations in name order, without copying the ids
+ * @param visit param 1 called with every id, returns whether to go on
+ * @param offset param 2 stations skipped first
+ * @param limit param 3 most stations visited
+ * @return number of stations visited
+ */
+std::size_t Datastructures::for_each_station_alphabetically(StationVisitor const& visit, std::size_t offset, std::size_t limit)
+{
+    OPERATION_METRICS(for_each_station_alphabetically);
+    return stations_sorted.for_each(offset, limit, visit);
+}
+/**
+ * @brief Datastructures::for_each_station_by_distance visits the stations in the order of stations_distance_increasing,
+ * without copying the ids
+ * @param visit param 1 called with every id, returns whether to go on
+ * @param offset param 2 stations skipped first
+ * @param limit param 3 most stations visited
+ * @return number of stations visited
+ */
+std::size_t Datastructures::for_each_station_by_distance(StationVisitor const& visit, std::size_t offset, std::size_t limit)
+{
+    OPERATION_METRICS(for_each_station_by_distance);
+    Paging page(offset, limit);
+    for(auto it = coord_map.begin(); it != coord_map.end() && !page.done(); ++it){
+        page.offer(std::string_view(stations[it->second].id), visit);
+    }
+    return page.count();
+}
+/**
+ * @brief Datastructures::for_each_region visits the regions in the order of all_regions
+ * @param visit param 1 called with every region id, returns whether to go on
+ * @param offset param 2 regions skipped first
+ * @param limit param 3 most regions visited
+ * @return number of regions visited
+ */
+std::size_t Datastructures::for_each_region(RegionVisitor const& visit, std::size_t offset, std::size_t limit)
+{
+    OPERATION_METRICS(for_each_region);
+    Paging page(offset, limit);
+    for(auto it = regions_map.begin(); it != regions_map.end() && !page.done(); ++it){
+        page.offer(it->first, visit);
+    }
+    return page.count();
+}
+/**
+ * @brief Datastructures::for_each_next_station visits the stations one hop away like next_stations_from,
+ * without copying the ids
+ * @param id param 1 station the hops leave from
+ * @param visit param 2 called with every id, returns whether to go on
+ * @param offset param 3 stations skipped first
+ * @param limit param 4 most stations visited
+ * @return number of stations visited, 0 when the station does not exist
+ */
+std::size_t Datastructures::for_each_next_station(StationID const& id, StationVisitor const& visit, std::size_t offset, std::size_t limit)
+{
+    OPERATION_METRICS(for_each_next_station);
+    StationIndex index = find_station(id);
+    if(index == NO_INDEX){return 0;}
+    Paging page(offset, limit);
+    auto const& neighbours = stations[index].neighbours;
+    for(std::size_t i = 0; i < neighbours.size() && !page.done(); ++i){
+        Station const& next = stations[neighbours[i]];
+        if(!next.removed){page.offer(std::string_view(next.id), visit);}
+    }
+    return page.count();
+}
+
+namespace
+{
+// Text input is read this many bytes at a time, only a line longer than this grows the buffer
+std::size_t const INGEST_CHUNK = std::size_t(1) << 20;
+
+std::string_view trim(std::string_view text)
+{
+    std::size_t begin = text.find_first_not_of(" \t\r");
+    if(begin == std::string_view::npos){return std::string_view();}
+    std::size_t end = text.find_last_not_of(" \t\r");
+    return text.substr(begin, end - begin + 1);
+}
+
+/**
+ * @brief for_each_record reads the stream in fixed size chunks and passes every non blank,
+ * non comment line to on_record as a view into the chunk, on_chunk runs after each chunk so
+ * the caller can flush whatever it collected before the buffer is reused
+ */
+template <typename OnRecord, typename OnChunk>
+void for_each_record(std::istream& input, OnRecord on_record, OnChunk on_chunk)
+{
+    std::vector<char> buffer(INGEST_CHUNK);
+    std::size_t kept = 0;
+    bool more = true;
+    while(more){
+        if(kept == buffer.size()){buffer.resize(buffer.size() * 2);}
+        input.read(buffer.data() + kept, static_cast<std::streamsize>(buffer.size() - kept));
+        more = static_cast<bool>(input);
+        char const* end = buffer.data() + kept + static_cast<std::size_t>(input.gcount());
+        char const* line = buffer.data();
+
+        auto emit = [&](char const* line_end){
+            std::string_view record = trim(std::string_view(line, static_cast<std::size_t>(line_end - line)));
+            if(!record.empty() && record.front() != '#'){on_record(record);}
+        };
+        while(auto newline = static_cast<char const*>(std::memchr(line, '\n', static_cast<std::size_t>(end - line)))){
+            emit(newline);
+            line = newline + 1;
+        }
+        if(!more && line != end){
+            emit(end);
+            line = end;
+        }
+        kept = static_cast<std::size_t>(end - line);
+        std::memmove(buffer.data(), line, kept);
+        on_chunk();
+    }
+}
+
+// Splits one record into comma separated fields without copying
+class FieldReader
+{
+public:
+    explicit FieldReader(std::string_view record) : rest_(record) {}
+
+    bool next(std::string_view& field)
+    {
+        if(done_){return false;}
+        std::size_t comma = rest_.find(',');
+        field = trim(rest_.substr(0, comma));
+        if(comma == std::string_view::npos){done_ = true;}
+        else{rest_.remove_prefix(comma + 1);}
+        return true;
+    }
+    bool done() const {return done_;}
+
+private:
+    std::string_view rest_;
+    bool done_ = false;
+};
+
+template <typename Number>
+bool parse_number(std::string_view field, Number& value)
+{
+    auto result = std::from_chars(field.data(), field.data() + field.size(), value);
+    return result.ec == std::errc() && result.ptr == field.data() + field.size();
+}
+}
+
+/**
+ * @brief Datastructures::ingest_stations adds stations from "id,name,x,y" lines
+ * @param input param 1 stream read chunk by chunk until its end
+ * @return number of stations added
+ */
+unsigned int Datastructures::ingest_stations(std::istream& input)
+{
+    OPERATION_METRICS(ingest_stations);
+    unsigned int count = 0;
+    std::vector<StationIndex> added;
+    for_each_record(input, [&](std::string_view record){
+        FieldReader fields(record);
+        std::string_view id, name, x, y;
+        Coord coord{0, 0};
+        if(!fields.next(id) || !fields.next(name) || !fields.next(x) || !fields.next(y) || !fields.done()
+           || id.empty() || !parse_number(x, coord.x) || !parse_number(y, coord.y)){return;}
+
+        StationIndex index = static_cast<StationIndex>(stations.size());
+        auto inserted = station_lookup.emplace(StationID(id), index);
+        if(!inserted.second){return;}
+        append_station(inserted.first->first, name, coord);
+        station_grid.insert(coord, index);
+        added.push_back(index);
+    }, [&](){
+        count += static_cast<unsigned int>(added.size());
+        index_stations(std::move(added));
+        added.clear();
+    });
+    return count;
+}
+/**
+ * @brief Datastructures::ingest_departures adds departures from "stationid,trainid,time" lines
+ * @param input param 1 stream read chunk by chunk until its end
+ * @return number of departures added
+ */
+unsigned int Datastructures::ingest_departures(std::istream& input)
+{
+    OPERATION_METRICS(ingest_departures);
+    unsigned int count = 0;
+    std::string station_key, train_key;
+    for_each_record(input, [&](std::string_view record){
+        FieldReader fields(record);
+        std::string_view station, train, time_field;
+        Time time = 0;
+        if(!fields.next(station) || !fields.next(train) || !fields.next(time_field) || !fields.done()
+           || train.empty() || !parse_number(time_field, time)){return;}
+
+        // The keys are reused so lookups stop allocating once they are long enough
+        station_key.assign(station);
+        StationIndex index = find_station(station_key);
+        if(index == NO_INDEX){return;}
+        train_key.assign(train);
+        insert_departure(index, intern_train(train_key), time);
+        ++count;
+    }, [](){});
+    return count;
+}
+/**
+ * @brief Datastructures::ingest_trains adds trains from "trainid,stationid,time,..." lines,
+ * a train is skipped like in add_train if it exists or any of its stations is unknown
+ * @param input param 1 stream read chunk by chunk until its end
+ * @return number of trains added
+ */
+unsigned int Datastructures::ingest_trains(std::istream& input)
+{
+    OPERATION_METRICS(ingest_trains);
+    unsigned int count = 0;
+    std::vector<TrainIndex> added;
+    std::vector<std::pair<StationIndex, Time>> stops;
+    std::string key;
+    for_each_record(input, [&](std::string_view record){
+        FieldReader fields(record);
+        std::string_view train, station, time_field;
+        if(!fields.next(train) || train.empty() || fields.done()){return;}
+        key.assign(train);
+        TrainIndex existing = find_train(key);
+        if(existing != NO_INDEX && trains[existing].added){return;}
+
+        stops.clear();
+        while(fields.next(station)){
+            Time time = 0;
+            if(!fields.next(time_field) || !parse_number(time_field, time)){return;}
+            key.assign(station);
+            StationIndex index = find_station(key);
+            if(index == NO_INDEX){return;}
+            stops.push_back(std::make_pair(index, time));
+        }
+
+        key.assign(train);
+        TrainIndex stored = intern_train(key);
+        trains[stored].stationtimes.assign(stops.begin(), stops.end());
+        trains[stored].added = true;
+        added.push_back(stored);
+    }, [&](){
+        count += static_cast<unsigned int>(added.size());
+        link_trains(added);
+        added.clear();
+    });
+    return count;
+}
+/**
+ * @brief Datastructures::pin returns the latest published view, safe to call from any thread
+ * @return view that stays unchanged while it is held
+ */
+std::shared_ptr<const NetworkView> Datastructures::pin() const
+{
+    OPERATION_METRICS(pin);
+    return std::atomic_load(&published);
+}
+/**
+ * @brief Datastructures::publish makes the current state visible to readers as a new view.
+ * Parts that did not change since the previous view are shared with it.
+ * @return version number of the new view
+ */
+std::uint64_t Datastructures::publish()
+{
+    OPERATION_METRICS(publish);
+    std::shared_ptr<const NetworkView> previous = std::atomic_load(&published);
+    bool reuse = previous && !everything_changed;
+    auto view = std::make_shared<NetworkView>();
+    view->version = previous ? previous->version + 1 : 1;
+
+    if(reuse && !stations_changed){
+        view->stations = previous->stations;
+    }
+    else{
+        auto table = std::make_shared<StationTable>();
+        table->ids.reserve(stations.size());
+        table->coords.reserve(stations.size());
+        for(StationIndex v = 0; v < stations.size(); ++v){
+            table->ids.push_back(stations[v].removed ? StationID() : stations[v].id);
+            table->coords.push_back(station_columns.coord(v));
+        }
+        table->lookup = station_lookup;
+        view->stations = std::move(table);
+    }
+
+    // A page is copied if a departure in it changed or stations were added to it
+    const StationIndex page_size = NetworkView::DEPARTURE_PAGE;
+    std::size_t pages = (stations.size() + page_size - 1) / page_size;
+    view->departure_pages.reserve(pages);
+    for(std::size_t page = 0; page < pages; ++page){
+        StationIndex begin = static_cast<StationIndex>(page * page_size);
+        StationIndex end = static_cast<StationIndex>(std::min<std::size_t>(stations.size(), begin + page_size));
+        bool changed = page < departure_pages_changed.size() && departure_pages_changed[page];
+        if(reuse && !changed && page < previous->departure_pages.size()
+                && previous->departure_pages[page]->size() == end - begin){
+            view->departure_pages.push_back(previous->departure_pages[page]);
+            continue;
+        }
+        auto copy = std::make_shared<NetworkView::DeparturePage>();
+        copy->reserve(end - begin);
+        for(StationIndex v = begin; v < end; ++v){copy->emplace_back(stations[v].departures.begin(), stations[v].departures.end());}
+        view->departure_pages.push_back(std::move(copy));
+    }
+
+    // Train ids only grow between clear_all calls
+    if(reuse && previous->train_ids->size() == train_ids.size()){
+        view->train_ids = previous->train_ids;
+    }
+    else{
+        view->train_ids = std::make_shared<const std::vector<TrainID>>(train_ids);
+    }
+
+    graph();
+    connections();
+    view->graph = graph_snapshot;
+    view->connections = connection_snapshot;
+
+    std::uint64_t version = view->version;
+    std::atomic_store(&published, std::shared_ptr<const NetworkView>(std::move(view)));
+    stations_changed = false;
+    everything_changed = false;
+    departure_pages_changed.clear();
+    return version;
+}
+/**
+ * @brief NetworkView::station_departures_after lists at most limit departures of a station after given time
+ * @param stationid param 1
+ * @param time param 2
+ * @param limit param 3 maximum number of departures returned
+ * @return vector pair of time and trainid
+ */
+std::vector<std::pair<Time, TrainID>> NetworkView::station_departures_after(StationID const& stationid, Time time, unsigned int limit) const
+{
+    OPERATION_METRICS(view_station_departures_after);
+    StationIndex index = find_station(stationid);
+    if(index == NO_INDEX){return {std::make_pair(NO_TIME, NO_TRAIN)};}
+    auto const& departures = (*departure_pages[index / DEPARTURE_PAGE])[index % DEPARTURE_PAGE];
+    return departures_after(departures, time, limit, [this](TrainIndex t){ return (*train_ids)[t]; });
+}
+/**
+ * @brief NetworkView::route_least_stations finds the route with least stations in this view
+ * @param fromid param 1 starting station
+ * @param toid param 2 destination station
+ * @return vector with stationID's and distances on the route
+ */
+std::vector<std::pair<StationID, Distance>> NetworkView::route_least_stations(StationID const& fromid, StationID const& toid) const
+{
+    OPERATION_METRICS(view_route_least_stations);
+    StationIndex from = find_station(fromid);
+    StationIndex to = find_station(toid);
+    if(from == NO_INDEX || to == NO_INDEX){return {{NO_STATION, NO_DISTANCE}};}
+
+    SearchWorkspace& ws = SearchWorkspace::for_thread();
+    if(!search_fewest_hops(*graph, stations->ids.size(), from, to, ws)){return {};}
+    return build_route(*graph, ws, from, to, [this](StationIndex v){ return stations->ids[v]; });
+}
+/**
+ * @brief NetworkView::route_shortest_distance finds the route with shortest distance in this view
+ * @param fromid param 1 starting station
+ * @param toid param 2 destination station
+ * @return vector with stationID's and cumulative distances on the route
+ */
+std::vector<std::pair<StationID, Distance>> NetworkView::route_shortest_distance(StationID const& fromid, StationID const& toid) const
+{
+    OPERATION_METRICS(view_route_shortest_distance);
+    StationIndex from = find_station(fromid);
+    StationIndex to = find_station(toid);
+    if(from == NO_INDEX || to == NO_INDEX){return {{NO_STATION, NO_DISTANCE}};}
+
+    SearchWorkspace& ws = SearchWorkspace::for_thread();
+    auto coord_of = [this](StationIndex v){ return stations->coords[v]; };
+    if(!search_shortest(*graph, stations->ids.size(), coord_of, from, to, true, ws)){return {};}
+    return build_route(*graph, ws, from, to, [this](StationIndex v){ return stations->ids[v]; });
+}
+/**
+ * @brief NetworkView::route_earliest_arrival finds the journey that arrives first in this view
+ * @param fromid param 1 starting station
+ * @param toid param 2 destination station
+ * @param departure_time param 3 earliest time the journey may leave
+ * @return (station, train taken from it, time) for every stop, the last entry is the arrival at toid
+ */
+std::vector<std::tuple<StationID, TrainID, Time>> NetworkView::route_earliest_arrival(StationID const& fromid, StationID const& toid,
+                                                                                   Time departure_time) const
+{
+    OPERATION_METRICS(view_route_earliest_arrival);
+    StationIndex from = find_station(fromid);
+    StationIndex to = find_station(toid);
+    if(from == NO_INDEX || to == NO_INDEX){return {std::make_tuple(NO_STATION, NO_TRAIN, NO_TIME)};}
+    if(from == to){return {std::make_tuple(fromid, NO_TRAIN, departure_time)};}
+
+    SearchWorkspace& ws = SearchWorkspace::for_thread();
+    if(!scan_connections(*connections, stations->ids.size(), train_ids->size(), from, to, departure_time, ws)){return {};}
+    return build_journey(*connections, ws, from, to, [this](StationIndex v){ return stations->ids[v]; },
+                         [this](TrainIndex t){ return (*train_ids)[t]; });
+}
+/**
+ * @brief WorkPool::WorkPool starts the worker threads
+ * @param threads param 1 number of threads besides the caller of run
+ */
+WorkPool::WorkPool(unsigned int threads)
+{
+    for(unsigned int i = 0; i <= threads; ++i){queues.push_back(std::make_unique<Queue>());}
+    for(unsigned int i = 0; i < threads; ++i){workers.emplace_back(&WorkPool::work, this, i);}
+}
+/**
+ * @brief WorkPool::~WorkPool stops and joins the worker threads
+ */
+WorkPool::~WorkPool()
+{
+    {
+        std::lock_guard<std::mutex> guard(state_lock);
+        stopping = true;
+    }
+    wake.notify_all();
+    for(auto& worker : workers){worker.join();}
+}
+/**
+ * @brief WorkPool::run splits [0, count) into chunks and runs task on them with every thread
+ * @param count param 1 number of items
+ * @param task param 2 called with disjoint [begin, end) ranges
+ */
+void WorkPool::run(std::size_t count, std::function<void(std::size_t, std::size_t)> const& task)
+{
+    if(count == 0){return;}
+    // Several chunks per thread so stealing can even out uneven queries
+    std::size_t chunk = std::max<std::size_t>(1, count / (queues.size() * 8));
+    std::size_t chunks = (count + chunk - 1) / chunk;
+
+    this->task = &task;
+    remaining.store(chunks);
+    for(std::size_t i = 0; i < chunks; ++i){
+        Queue& queue = *queues[i % queues.size()];
+        std::lock_guard<std::mutex> guard(queue.lock);
+        queue.chunks.push_back({i * chunk, std::min(count, (i + 1) * chunk)});
+    }
+    {
+        std::lock_guard<std::mutex> guard(state_lock);
+        ++generation;
+    }
+    wake.notify_all();
+
+    drain(queues.size() - 1);
+    std::unique_lock<std::mutex> guard(state_lock);
+    done.wait(guard, [this]{ return remaining.load() == 0; });
+    this->task = nullptr;
+}
+/**
+ * @brief WorkPool::take pops a chunk from the own queue or steals one from another queue
+ * @return false when every queue is empty
+ */
+bool WorkPool::take(std::size_t self, std::pair<std::size_t, std::size_t>& chunk)
+{
+    {
+        Queue& own = *queues[self];
+        std::lock_guard<std::mutex> guard(own.lock);
+        if(!own.chunks.empty()){
+            chunk = own.chunks.back();
+            own.chunks.pop_back();
+            return true;
+        }
+    }
+    for(std::size_t i = 1; i < queues.size(); ++i){
+        Queue& victim = *queues[(self + i) % queues.size()];
+        std::lock_guard<std::mutex> guard(victim.lock);
+        if(!victim.chunks.empty()){
+            chunk = victim.chunks.front();
+            victim.chunks.pop_front();
+            return true;
+        }
+    }
+    return false;
+}
+/**
+ * @brief WorkPool::drain runs chunks until no queue has any left
+ */
+void WorkPool::drain(std::size_t self)
+{
+    std::pair<std::size_t, std::size_t> chunk;
+    while(take(self, chunk)){
+        (*task)(chunk.first, chunk.second);
+        if(remaining.fetch_sub(1) == 1){
+            std::lock_guard<std::mutex> guard(state_lock);
+            done.notify_all();
+        }
+    }
+}
+/**
+ * @brief WorkPool::work loop of one worker thread, sleeps until run hands out a new batch
+ */
+void WorkPool::work(std::size_t self)
+{
+    std::uint64_t seen = 0;
+    while(true){
+        {
+            std::unique_lock<std::mutex> guard(state_lock);
+            wake.wait(guard, [&]{ return stopping || generation != seen; });
+            if(stopping){return;}
+            seen = generation;
+        }
+        drain(self);
+    }
+}
+/**
+ * @brief Datastructures::work_pool returns the thread pool of the batch operations, starting it on first use
+ * @return pool with one thread per hardware thread including the caller
+ */
+WorkPool& Datastructures::work_pool()
+{
+    if(!pool){
+        unsigned int threads = std::max(1u, std::thread::hardware_concurrency());
+        pool = std::make_unique<WorkPool>(threads - 1);
+    }
+    return *pool;
+}
+/**
+ * @brief Datastructures::route_many answers many route queries in parallel
+ * @param queries param 1 (from, to) pairs
+ * @param fewest_stations param 2 answer like route_least_stations instead of route_shortest_distance
+ * @return one route per query in the same order
+ */
+std::vector<std::vector<std::pair<StationID, Distance>>> Datastructures::route_many(std::vector<std::pair<StationID, StationID>> const& queries,
+                                                                                    bool fewest_stations)
+{
+    OPERATION_METRICS(route_many);
+    std::vector<std::vector<std::pair<StationID, Distance>>> result(queries.size());
+    // Built here so the workers only read it
+    const Graph& g = graph();
+    work_pool().run(queries.size(), [&](std::size_t begin, std::size_t end){
+        OPERATION_SCOPE(route_many);
+        for(std::size_t i = begin; i < end; ++i){
+            result[i] = route_on(g, queries[i].first, queries[i].second, fewest_stations);
+        }
+    });
+    return result;
+}
+/**
+ * @brief Datastructures::closest_many finds the closest stations of many coordinates in parallel
+ * @param coords param 1 query coordinates
+ * @param k param 2 stations wanted per coordinate
+ * @return stationids closest first, one vector per coordinate in the same order
+ */
+std::vector<std::vector<StationID>> Datastructures::closest_many(std::vector<Coord> const& coords, unsigned int k)
+{
+    OPERATION_METRICS(closest_many);
+    std::vector<std::vector<StationID>> result(coords.size());
+    work_pool().run(coords.size(), [&](std::size_t begin, std::size_t end){
+        std::vector<SpatialGrid::Hit> hits;
+        for(std::size_t i = begin; i < end; ++i){
+            station_grid.nearest(coords[i], k, hits);
+            result[i].reserve(hits.size());
+            for(auto const& hit : hits){result[i].push_back(stations[hit.second].id);}
+        }
+    });
+    return result;
+}
+/**
+ * @brief Datastructures::generate_network replaces the contents with a deterministic synthetic network
+ * @param seed param 1 seed of rand_engine
+ * @param station_count param 2 number of stations, regions and trains scale with it
+ */
+void Datastructures::generate_network(unsigned int seed, unsigned int station_count)
+{
+    OPERATION_METRICS(generate_network);
+    // The station, region and train ids it hands out would collide with existing ones
+    clear_all();
+    if(station_count == 0){return;}
+    rand_engine.seed(seed);
+    // The square grows with the station count so the density stays the same
+    int side = static_cast<int>(1000.0 * std::sqrt(double(station_count)));
+
+    std::vector<std::tuple<StationID, Name, Coord>> new_stations;
+    new_stations.reserve(station_count);
+    for(unsigned int i = 0; i < station_count; ++i){
+        Name name(1, random_in_range('A', 'Z'));
+        for(int c = random_in_range(4, 9); c > 0; --c){name.push_back(random_in_range('a', 'z'));}
+        new_stations.emplace_back("S" + std::to_string(i), std::move(name), Coord{random_in_range(0, side), random_in_range(0, side)});
+    }
+    add_stations_bulk(std::move(new_stations));
+
+    // Region r > 1 is quadrant (r - 2) % 4 of region (r - 2) / 4 + 1
+    unsigned int region_count = std::max(1u, station_count / 100);
+    std::vector<Box> boxes(region_count + 1);
+    boxes[1].extend(Coord{0, 0});
+    boxes[1].extend(Coord{side, side});
+    std::vector<std::tuple<RegionID, Name, std::vector<Coord>>> new_regions;
+    new_regions.reserve(region_count);
+    for(unsigned int r = 1; r <= region_count; ++r){
+        if(r > 1){
+            Box const& parent = boxes[(r - 2) / 4 + 1];
+            int mid_x = parent.min_x + (parent.max_x - parent.min_x) / 2;
+            int mid_y = parent.min_y + (parent.max_y - parent.min_y) / 2;
+            unsigned int quadrant = (r - 2) % 4;
+            boxes[r].extend(Coord{quadrant & 1 ? mid_x : parent.min_x, quadrant & 2 ? mid_y : parent.min_y});
+            boxes[r].extend(Coord{quadrant & 1 ? parent.max_x : mid_x, quadrant & 2 ? parent.max_y : mid_y});
+        }
+        Box const& b = boxes[r];
+        new_regions.emplace_back(r, "Region " + std::to_string(r), std::vector<Coord>{
+                                     {b.min_x, b.min_y}, {b.max_x, b.min_y}, {b.max_x, b.max_y}, {b.min_x, b.max_y}});
+    }
+    add_regions_bulk(std::move(new_regions));
+    for(unsigned int r = 2; r <= region_count; ++r){add_subregion_to_region(r, (r - 2) / 4 + 1);}
+    assign_stations_to_regions_by_geometry();
+
+    // Hubs are the stations nearest to the centres of a grid of cells holding about 25
+    // stations each. Trunk lines join the hubs of every row and column, so the hubs are
+    // connected, and every feeder line ends at the hub of the cell it ends in.
+    unsigned int cells = std::max(1u, static_cast<unsigned int>(std::sqrt(station_count / 25.0)));
+    double cell_size = double(side) / cells;
+    std::vector<SpatialGrid::Hit> hits;
+    auto hub = [&](double x, double y){
+        std::size_t cx = std::min<std::size_t>(cells - 1, static_cast<std::size_t>(x / cell_size));
+        std::size_t cy = std::min<std::size_t>(cells - 1, static_cast<std::size_t>(y / cell_size));
+        station_grid.nearest(Coord{static_cast<int>((cx + 0.5) * cell_size), static_cast<int>((cy + 0.5) * cell_size)}, 1, hits);
+        return hits.front().second;
+    };
+
+    // Feeders walk to one of the few nearest stations they have not visited yet
+    std::vector<std::vector<StationIndex>> lines(std::max(1u, station_count / 4));
+    for(auto& line : lines){
+        line.assign(1, random_in_range(0u, station_count - 1));
+        unsigned int stops = random_in_range(4u, 12u);
+        while(line.size() < stops){
+            station_grid.nearest(station_columns.coord(line.back()), 6, hits);
+            auto unvisited = std::remove_if(hits.begin(), hits.end(), [&](SpatialGrid::Hit const& hit){
+                return std::find(line.begin(), line.end(), hit.second) != line.end();
+            });
+            if(unvisited == hits.begin()){break;}
+            line.push_back(hits[random_in_range(std::size_t(0), std::size_t(unvisited - hits.begin()) - 1)].second);
+        }
+        StationIndex end = hub(station_columns.x[line.back()], station_columns.y[line.back()]);
+        if(std::find(line.begin(), line.end(), end) == line.end()){line.push_back(end);}
+    }
+    // Trunks are cut into runs of 10 hubs, consecutive runs share their end hub
+    for(unsigned int direction = 0; direction < 2; ++direction){
+        for(unsigned int row = 0; row < cells; ++row){
+            std::vector<StationIndex> trunk;
+            for(unsigned int c = 0; c < cells; ++c){
+                double along = (c + 0.5) * cell_size;
+                double across = (row + 0.5) * cell_size;
+                StationIndex next = direction == 0 ? hub(along, across) : hub(across, along);
+                if(trunk.empty() || trunk.back() != next){trunk.push_back(next);}
+            }
+            for(std::size_t begin = 0; begin + 1 < trunk.size(); begin += 9){
+                lines.emplace_back(trunk.begin() + begin, trunk.begin() + std::min(trunk.size(), begin + 10));
+            }
+        }
+    }
+
+    std::vector<std::pair<TrainID, std::vector<std::pair<StationID, Time>>>> new_trains;
+    new_trains.reserve(4 * lines.size());
+    std::vector<Time> offsets;
+    for(std::size_t l = 0; l < lines.size(); ++l){
+        auto const& line = lines[l];
+        offsets.assign(1, random_in_range(0, 600));
+        while(offsets.size() < line.size()){offsets.push_back(offsets.back() + random_in_range(2, 15));}
+        // Trips 0 and 1 run the line out, trips 2 and 3 run it back half an hour later
+        for(unsigned int trip = 0; trip < 4; ++trip){
+            bool back = trip >= 2;
+            std::vector<std::pair<StationID, Time>> stationtimes;
+            stationtimes.reserve(line.size());
+            for(std::size_t i = 0; i < line.size(); ++i){
+                StationIndex stop = back ? line[line.size() - 1 - i] : line[i];
+                stationtimes.emplace_back(stations[stop].id, static_cast<Time>(offsets[i] + 60 * (trip % 2) + 30 * back));
+            }
+            new_trains.emplace_back("T" + std::to_string(l) + "_" + std::to_string(trip), std::move(stationtimes));
+        }
+    }
+    add_trains_bulk(std::move(new_trains));
+}
+/**
+ * @brief Datastructures::metrics_snapshot sums the operation metrics of every thread
+ * @param format param 1 JSON object or Prometheus text exposition
+ * @return the operations called so far with their calls, nodes expanded and latency histogram,
+ * empty when built without DATASTRUCTURES_METRICS
+ */
+std::string Datastructures::metrics_snapshot(MetricsFormat format)
+{
+    std::string result = format == MetricsFormat::json ? "{\"operations\":{" : "";
+#ifdef DATASTRUCTURES_METRICS
+    std::vector<std::array<std::uint64_t, 3 + LATENCY_BUCKETS>> totals(METRIC_COUNT);
+    {
+        MetricsRegistry& registry = metrics_registry();
+        std::lock_guard<std::mutex> guard(registry.lock);
+        for(std::size_t m = 0; m < METRIC_COUNT; ++m){
+            std::copy(std::begin(registry.retired[m]), std::end(registry.retired[m]), totals[m].begin());
+            for(auto thread : registry.threads){thread->add_to(m, totals[m].data());}
+        }
+    }
+
+    auto seconds = [](double ns){
+        char text[32];
+        std::snprintf(text, sizeof(text), "%.9g", ns / 1e9);
+        return std::string(text);
+    };
+    bool first = true;
+    for(std::size_t m = 0; m < METRIC_COUNT; ++m){
+        auto const& total = totals[m];
+        if(total[0] == 0){continue;}
+        std::string name = METRIC_NAMES[m];
+        // Histograms stop at the slowest bucket that was hit
+        std::size_t used = LATENCY_BUCKETS;
+        while(used > 0 && total[3 + used - 1] == 0){--used;}
+
+        if(format == MetricsFormat::json){
+            result += (first ? "\"" : ",\"") + name + "\":{\"calls\":" + std::to_string(total[0])
+                    + ",\"total_ns\":" + std::to_string(total[1]) + ",\"nodes_expanded\":" + std::to_string(total[2])
+                    + ",\"latency_ns_log2\":[";
+            for(std::size_t b = 0; b < used; ++b){
+                result += (b ? "," : "") + std::to_string(total[3 + b]);
+            }
+            result += "]}";
+        }
+        else{
+            std::string label = "{operation=\"" + name + "\"";
+            if(first){
+                result += "# HELP datastructures_nodes_expanded_total Stations or connections expanded by route searches.\n"
+                          "# TYPE datastructures_nodes_expanded_total counter\n"
+                          "# HELP datastructures_operation_seconds Latency of the public operations.\n"
+                          "# TYPE datastructures_operation_seconds histogram\n";
+            }
+            result += "datastructures_nodes_expanded_total" + label + "} " + std::to_string(total[2]) + "\n";
+            std::uint64_t cumulative = 0;
+            for(std::size_t b = 0; b < used; ++b){
+                cumulative += total[3 + b];
+                result += "datastructures_operation_seconds_bucket" + label + ",le=\"" + seconds(double(std::uint64_t(2) << b))
+                        + "\"} " + std::to_string(cumulative) + "\n";
+            }
+            result += "datastructures_operation_seconds_bucket" + label + ",le=\"+Inf\"} " + std::to_string(total[0]) + "\n";
+            result += "datastructures_operation_seconds_sum" + label + "} " + seconds(double(total[1])) + "\n";
+            result += "datastructures_operation_seconds_count" + label + "} " + std::to_string(total[0]) + "\n";
+        }
+        first = false;
+    }
+#endif
+    if(format == MetricsFormat::json){result += "}}";}
+    return result;
+}
@@ -9,17 +9,30 @@
 
 #include <string>
 #include <vector>
+#include <cstdint>
 #include <utility>
 #include <limits>
 #include <functional>
 #include <exception>
 #include <unordered_set>
+#include <unordered_map>
 #include <list>
 #include <set>
 #include <map>
 #include <cmath>
 #include <stack>
 #include <queue>
+#include <memory>
+#include <algorithm>
+#include <tuple>
+#include <istream>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <atomic>
+#include <memory_resource>
+#include <string_view>
 
 // Types for IDs
 using StationID = std::string;
@@ -29,12 +42,18 @@ using Name = std::string;
 using Time = unsigned short int;
 
 
+// Dense internal handles for interned IDs, only used inside Datastructures
+using StationIndex = std::uint32_t;
+using TrainIndex = std::uint32_t;
+
+
 // Return values for cases where required thing was not found
 StationID const NO_STATION = "---";
 TrainID const NO_TRAIN = "---";
 RegionID const NO_REGION = -1;
 Name const NO_NAME = "!NO_NAME!";
 Time const NO_TIME = 9999;
+std::uint32_t const NO_INDEX = std::numeric_limits<std::uint32_t>::max();
 
 // Return value for cases where integer values were not found
 int const NO_VALUE = std::numeric_limits<int>::min();
@@ -104,45 +123,440 @@ private:
 // This is the class you are supposed to implement
 struct Region;
 
+// Members of stations, regions and trains are allocated from the memory
+// resource of the Datastructures that owns them
 struct Station{
     StationID id;
-    Name name;
-    Coord coord;
-    std::vector<std::pair<TrainID, Time>> departures;
-    Region* ptr;
-    std::vector<StationID> neighbours;
+    std::pmr::string name;
+    // Kept sorted by time, equal times in insertion order
+    std::pmr::vector<std::pair<Time, TrainIndex>> departures;
+    // One entry per train hop leaving the station, neighbour_weights[i] is
+    // the length of the hop to neighbours[i]
+    std::pmr::vector<StationIndex> neighbours;
+    std::pmr::vector<Distance> neighbour_weights;
+    // Source of every hop arriving at the station
+    std::pmr::vector<StationIndex> predecessors;
+    // Every stop made at the station as (train, position in its stationtimes),
+    // sorted so the stops of one train are together
+    std::pmr::vector<std::pair<TrainIndex, std::uint32_t>> train_stops;
+    bool removed = false;
+};
 
+// Station fields read by scans and searches, kept apart from the rest of
+// Station so a pass over them touches nothing else. Entry v of every
+// column belongs to stations[v].
+struct StationColumns{
+    std::vector<int> x;
+    std::vector<int> y;
+    // Region the station was added to, nullptr if none
+    std::vector<Region*> region;
+
+    Coord coord(StationIndex v) const{ return Coord{x[v], y[v]}; }
+    void set_coord(StationIndex v, Coord c){ x[v] = c.x; y[v] = c.y; }
+    void push_back(Coord c){ x.push_back(c.x); y.push_back(c.y); region.push_back(nullptr); }
+    void reserve(std::size_t n){ x.reserve(n); y.reserve(n); region.reserve(n); }
+    void clear(){ x.clear(); y.clear(); region.clear(); }
 };
 
 struct Region{
-    Name name;
-    std::vector<Coord> coord;
+    std::pmr::string name;
+    std::pmr::vector<Coord> coord;
     RegionID id;
     Region* parent;
+    std::pmr::vector<Region*> children;
+    // Preorder interval of the subtree in RegionForest::order, the region
+    // itself is at tin and its subregions fill tin+1 .. tout-1
+    std::uint32_t tin = 0;
+    std::uint32_t tout = 0;
 };
 
+using RegionMap = std::pmr::unordered_map<RegionID, Region>;
+
+// Euler tour and binary lifting tables over the region forest.
+// up[j][i] is the position of the 2^j:th ancestor of the region at
+// preorder position i, roots point to themselves.
+struct RegionForest{
+    std::vector<Region*> order;
+    std::vector<std::vector<std::uint32_t>> up;
+
+    static bool is_ancestor(Region const& a, Region const& b){
+        return a.tin <= b.tin && b.tin < a.tout;
+    }
+};
+
+// Orders coordinates by distance from the origin, ties by y and then x.
+// Each square is at most 2^62, so the sum of two is taken unsigned where up to
+// 2^63 fits, the NO_COORD sentinel at INT_MIN included.
 struct CoordComparator{
     bool operator()(const Coord& c1, const Coord& c2) const{
-        if (c1.x == c2.x && c1.y == c2.y){
-            return false;
+        std::uint64_t d1 = std::uint64_t(std::int64_t(c1.x)*c1.x) + std::uint64_t(std::int64_t(c1.y)*c1.y);
+        std::uint64_t d2 = std::uint64_t(std::int64_t(c2.x)*c2.x) + std::uint64_t(std::int64_t(c2.y)*c2.y);
+        if (d1 != d2){
+            return d1 < d2;
         }
-        else if (c1.x == c2.x){
+        else if (c1.y != c2.y){
             return c1.y < c2.y;
         }
-        else if (c1.y == c2.y){
-            return c1.x < c2.x;
-        }
         else{
-            return (c1.x*c1.x + c1.y*c1.y) < (c2.x*c2.x + c2.y*c2.y);
+            return c1.x < c2.x;
         }
     }
 };
 
 struct Train{
 
-    std::vector<std::pair<StationID, Time> > stationtimes;
+    std::pmr::vector<std::pair<StationIndex, Time> > stationtimes;
+    // (station, position in stationtimes) of every stop, sorted
+    std::pmr::vector<std::pair<StationIndex, std::uint32_t>> stops_by_station;
+    bool added = false;
+};
+
+// Immutable compressed sparse row snapshot of the train network.
+// Edges of station v are targets[offsets[v]] .. targets[offsets[v+1]-1]
+// and weights holds the length of each edge at the same position.
+struct Graph{
+    std::vector<std::uint32_t> offsets;
+    std::vector<StationIndex> targets;
+    std::vector<Distance> weights;
+    // Smallest weight / straight line length ratio over all edges. Scaling the
+    // straight line distance by it keeps the A* heuristic consistent even
+    // though weights are truncated to whole metres.
+    double heuristic_scale = 1.0;
+
+    // Stations added after the snapshot was built have no edges yet
+    std::uint32_t edges_begin(StationIndex v) const{
+        return v + 1 < offsets.size() ? offsets[v] : 0;
+    }
+    std::uint32_t edges_end(StationIndex v) const{
+        return v + 1 < offsets.size() ? offsets[v + 1] : 0;
+    }
+};
+
+// Axis aligned bounding box
+struct Box{
+    int min_x = std::numeric_limits<int>::max();
+    int min_y = std::numeric_limits<int>::max();
+    int max_x = std::numeric_limits<int>::min();
+    int max_y = std::numeric_limits<int>::min();
+
+    void extend(Coord c){
+        min_x = std::min(min_x, c.x); max_x = std::max(max_x, c.x);
+        min_y = std::min(min_y, c.y); max_y = std::max(max_y, c.y);
+    }
+    void extend(Box const& b){
+        min_x = std::min(min_x, b.min_x); max_x = std::max(max_x, b.max_x);
+        min_y = std::min(min_y, b.min_y); max_y = std::max(max_y, b.max_y);
+    }
+    bool contains(Coord c) const{
+        return min_x <= c.x && c.x <= max_x && min_y <= c.y && c.y <= max_y;
+    }
+};
+
+// Static R-tree over the region polygons, bulk loaded with
+// sort-tile-recursive packing. Nodes are stored level by level with the
+// root last, the children of an inner node are nodes[first .. first+count-1]
+// and those of a leaf are entries[first .. first+count-1].
+struct RegionRTree{
+    struct Entry{
+        Box box;
+        Region* region;
+        double area;
+    };
+    struct Node{
+        Box box;
+        std::uint32_t first;
+        std::uint32_t count;
+        bool leaf;
+    };
+    static constexpr std::uint32_t FANOUT = 16;
+
+    std::vector<Entry> entries;
+    std::vector<Node> nodes;
+
+    void build(RegionMap& regions);
+    // Regions whose polygon contains xy
+    void containing(Coord xy, std::vector<Entry const*>& out) const;
+};
+
+// One hop of a train between two consecutive stops
+struct Connection{
+    Time departure;
+    Time arrival;
+    StationIndex from;
+    StationIndex to;
+    TrainIndex train;
+};
+
+// Trains grouped into route patterns for RAPTOR. A pattern is a stop
+// sequence shared by trips that never overtake each other, so at every
+// stop the trips are in time order. Stops of pattern r are
+// stops[stop_begin[r] .. stop_begin[r+1]-1], its trips are
+// trips[trip_begin[r] .. trip_begin[r+1]-1] and the time of trip i at
+// stop p is times[time_begin[r] + i * stop_count + p].
+struct RoutePatterns{
+    std::vector<std::uint32_t> stop_begin;
+    std::vector<StationIndex> stops;
+    std::vector<std::uint32_t> trip_begin;
+    std::vector<TrainIndex> trips;
+    std::vector<std::uint32_t> time_begin;
+    std::vector<Time> times;
+    // (pattern, stop position) pairs of station v are
+    // station_patterns[station_begin[v] .. station_begin[v+1]-1]
+    std::vector<std::uint32_t> station_begin;
+    std::vector<std::pair<std::uint32_t, std::uint32_t>> station_patterns;
+
+    std::uint32_t pattern_count() const{ return static_cast<std::uint32_t>(stop_begin.size()) - 1; }
+    std::uint32_t stop_count(std::uint32_t r) const{ return stop_begin[r + 1] - stop_begin[r]; }
+    std::uint32_t trip_count(std::uint32_t r) const{ return trip_begin[r + 1] - trip_begin[r]; }
+    Time time(std::uint32_t r, std::uint32_t trip, std::uint32_t p) const{
+        return times[time_begin[r] + trip * stop_count(r) + p];
+    }
+};
+
+// Uniform grid over station coordinates for nearest and radius queries.
+// Cells are hashed so the grid has no fixed bounds. The cell size is picked
+// again whenever the station count has doubled since the last rebuild, so a
+// cell holds about STATIONS_PER_CELL stations. Cells are sized for the batch
+// distance kernel, which makes a fuller cell cheaper than another hash probe.
+struct SpatialGrid{
+    // Squared distance to the query point and the station. Two differences of
+    // int coordinates can each be near 2^32, so the sum saturates at the
+    // largest uint64 instead of wrapping.
+    using Hit = std::pair<std::uint64_t, StationIndex>;
+
+    void insert(Coord xy, StationIndex v);
+    void erase(Coord xy, StationIndex v);
+    void clear();
+    // k closest stations, closest first
+    void nearest(Coord xy, std::size_t k, std::vector<Hit>& out) const;
+    // Stations at most radius away, closest first
+    void within(Coord xy, Distance radius, std::vector<Hit>& out) const;
+
+    // Batch kernel of the queries, squared distances from xy to n points given as x and y
+    // arrays. With avx2 set it returns false when the processor has no AVX2.
+    static bool squared_distances(int const* x, int const* y, std::size_t n, Coord xy, std::uint64_t* out, bool avx2);
+
+private:
+    // Coordinates of a cell are kept as separate x and y arrays for the batch distance kernel
+    struct Cell{
+        std::vector<int> x;
+        std::vector<int> y;
+        std::vector<StationIndex> stations;
+    };
+    static constexpr std::size_t STATIONS_PER_CELL = 16;
+    std::int64_t cell_size = 1024;
+    std::unordered_map<std::uint64_t, Cell> cells;
+    // Bounding box of the occupied cells, not shrunk on erase
+    std::int64_t min_cx = 0, max_cx = -1, min_cy = 0, max_cy = -1;
+    std::size_t count = 0;
+    std::size_t rebuild_at = 64;
+
+    std::int64_t cell_of(int v) const{
+        return v >= 0 ? v / cell_size : -((cell_size - 1 - std::int64_t(v)) / cell_size);
+    }
+    static std::uint64_t key(std::int64_t cx, std::int64_t cy){
+        return (std::uint64_t(std::uint32_t(cx)) << 32) | std::uint32_t(cy);
+    }
+    void scan_cell(Cell const& entries, Coord xy, std::size_t k, std::vector<Hit>& best) const;
+    void rebuild();
+};
+
+// Station names in alphabetical order, equal names ordered by station id so
+// every station keeps its own entry. The entries are sorted arrays of at most
+// 2 * BLOCK entries each, laid end to end. A query is a binary search over the
+// blocks and within one block followed by a sequential scan. An insert or an
+// erase only moves the entries of its own block, a full block is split in two.
+// The entries are station indexes compared through the station table, so no
+// name is copied; they are renumbered with the stations.
+struct NameIndex{
+    explicit NameIndex(std::vector<Station> const& stations) : stations(&stations){}
+
+    void insert(StationIndex v);
+    // Many entries at once, large batches rebuild the blocks with one merge
+    void insert_many(std::vector<StationIndex> added);
+    // The station must still hold the name and id it was inserted with
+    void erase(StationIndex v);
+    void clear();
+    // renumber[v] is the new index of station v, the order does not change
+    void renumber(std::vector<StationIndex> const& renumber);
+    std::size_t size() const{ return count; }
+
+    // Up to count ids in name order starting at from, or right after (from, after_id)
+    // when after_id is given
+    void page(std::string_view from, StationID const* after_id, std::size_t count, std::vector<StationID>& out) const;
+    // Up to limit ids of the stations whose name starts with prefix, in name order
+    void with_prefix(std::string_view prefix, std::size_t limit, std::vector<StationID>& out) const;
+    // Every id in name order after skipping offset of them, until visit returns false or limit
+    // ids were visited. Returns the number visited.
+    std::size_t for_each(std::size_t offset, std::size_t limit, std::function<bool(std::string_view)> const& visit) const;
+
+private:
+    static constexpr std::size_t BLOCK = 128;
+    std::vector<Station> const* stations;
+    std::vector<std::vector<StationIndex>> blocks;
+    std::size_t count = 0;
+
+    // Name order, equal names by station id
+    bool before(StationIndex a, StationIndex b) const;
+    template<typename Visit>
+    void scan(std::string_view from, StationID const* after_id, Visit visit) const;
+    std::size_t block_for(StationIndex v) const;
+};
+
+// Per-thread scratch state for the route searches. Arrays are indexed by
+// StationIndex and only grow, entries count as set only when their stamp
+// equals the current epoch so starting a new search is O(1).
+struct SearchWorkspace{
+    std::vector<std::uint32_t> reached;
+    std::vector<std::uint32_t> settled;
+    std::vector<StationIndex> parent;
+    // Graph edge from the parent, set by the graph searches
+    std::vector<std::uint32_t> parent_edge;
+    std::vector<Distance> distance;
+    // Every station is enqueued at most once per search, so a buffer of
+    // station count entries with head and tail positions never overflows
+    std::vector<StationIndex> queue;
+    std::size_t head = 0;
+    std::size_t tail = 0;
+    std::vector<std::pair<Distance, StationIndex>> heap;
+    // Indexed by TrainIndex, stamped when the train has been boarded
+    std::vector<std::uint32_t> boarded;
+    // RAPTOR rounds: the stations improved in the current round, the route patterns
+    // through them and, indexed by pattern, the first stop to scan. A scanned pattern
+    // is reset to NO_INDEX, so first_stop needs no stamp.
+    std::vector<StationIndex> marked;
+    std::vector<std::uint32_t> patterns;
+    std::vector<std::uint32_t> first_stop;
+    std::uint32_t epoch = 0;
+
+    void start(std::size_t size, std::size_t train_count = 0){
+        if(reached.size() < size){
+            reached.resize(size, 0);
+            settled.resize(size, 0);
+            parent.resize(size, NO_INDEX);
+            parent_edge.resize(size, NO_INDEX);
+            distance.resize(size, 0);
+            queue.resize(size);
+        }
+        if(boarded.size() < train_count){
+            boarded.resize(train_count, 0);
+        }
+        if(++epoch == 0){
+            std::fill(reached.begin(), reached.end(), 0);
+            std::fill(settled.begin(), settled.end(), 0);
+            std::fill(boarded.begin(), boarded.end(), 0);
+            epoch = 1;
+        }
+        head = tail = 0;
+        heap.clear();
+    }
+    bool is_reached(StationIndex v) const{ return reached[v] == epoch; }
+    bool is_settled(StationIndex v) const{ return settled[v] == epoch; }
+    void reach(StationIndex v, StationIndex from){ reached[v] = epoch; parent[v] = from; }
+    void reach(StationIndex v, StationIndex from, std::uint32_t edge){ reach(v, from); parent_edge[v] = edge; }
+    void settle(StationIndex v){ settled[v] = epoch; }
+    void push(StationIndex v){ queue[tail++] = v; }
+    StationIndex pop(){ return queue[head++]; }
+    bool empty() const{ return head == tail; }
+
+    // Workspace of the calling thread, buffers are kept between queries
+    static SearchWorkspace& for_thread();
+};
+
+// Station ids, coordinates and the id lookup as they were when a view was published
+struct StationTable{
+    std::vector<StationID> ids;
+    std::vector<Coord> coords;
+    std::unordered_map<StationID, StationIndex> lookup;
 };
 
+// Immutable version of the network for concurrent readers. Every part is
+// shared with the previous version unless it changed in between, departures
+// are split into pages of DEPARTURE_PAGE stations so a timetable update only
+// copies the pages it touched. Any number of threads may query one view
+// while the writer keeps changing the Datastructures and publishing.
+struct NetworkView{
+    static constexpr StationIndex DEPARTURE_PAGE = 64;
+    using DeparturePage = std::vector<std::vector<std::pair<Time, TrainIndex>>>;
+
+    std::uint64_t version = 0;
+    std::shared_ptr<const StationTable> stations;
+    std::vector<std::shared_ptr<const DeparturePage>> departure_pages;
+    std::shared_ptr<const std::vector<TrainID>> train_ids;
+    std::shared_ptr<const Graph> graph;
+    std::shared_ptr<const std::vector<Connection>> connections;
+
+    // Same results as the Datastructures operations of the same name at the time of publishing
+
+    // Estimate of performance: O(log d + k)
+    // Short rationale for estimate: binary search in the d departures of one page entry
+    std::vector<std::pair<Time, TrainID>> station_departures_after(StationID const& stationid, Time time,
+                                                                   unsigned int limit = std::numeric_limits<unsigned int>::max()) const;
+
+    // Estimate of performance: O(n + e)
+    // Short rationale for estimate: breadth first search on the graph of the view
+    std::vector<std::pair<StationID, Distance>> route_least_stations(StationID const& fromid, StationID const& toid) const;
+
+    // Estimate of performance: O((n + e) log n)
+    // Short rationale for estimate: A* on the graph of the view
+    std::vector<std::pair<StationID, Distance>> route_shortest_distance(StationID const& fromid, StationID const& toid) const;
+
+    // Estimate of performance: O(C)
+    // Short rationale for estimate: one connection scan over the hops of the view
+    std::vector<std::tuple<StationID, TrainID, Time>> route_earliest_arrival(StationID const& fromid, StationID const& toid,
+                                                                              Time departure_time) const;
+
+    StationIndex find_station(StationID const& id) const{
+        auto it = stations->lookup.find(id);
+        if(it == stations->lookup.end()){return NO_INDEX;}
+        return it->second;
+    }
+};
+
+// Worker threads for the batch operations. A batch over [0, count) is cut
+// into chunks dealt round robin to one deque per worker. A worker takes
+// chunks from the back of its own deque and steals from the front of the
+// others once it runs dry. The thread calling run() works as the last worker.
+class WorkPool{
+public:
+    explicit WorkPool(unsigned int threads);
+    ~WorkPool();
+    WorkPool(WorkPool const&) = delete;
+    WorkPool& operator=(WorkPool const&) = delete;
+
+    // Calls task(begin, end) on disjoint ranges covering [0, count), returns when all are done
+    void run(std::size_t count, std::function<void(std::size_t, std::size_t)> const& task);
+
+private:
+    struct Queue{
+        std::mutex lock;
+        std::deque<std::pair<std::size_t, std::size_t>> chunks;
+    };
+    std::vector<std::thread> workers;
+    // One per worker and the last one for the calling thread
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::function<void(std::size_t, std::size_t)> const* task = nullptr;
+    std::atomic<std::size_t> remaining{0};
+
+    std::mutex state_lock;
+    std::condition_variable wake;
+    std::condition_variable done;
+    std::uint64_t generation = 0;
+    bool stopping = false;
+
+    bool take(std::size_t self, std::pair<std::size_t, std::size_t>& chunk);
+    void drain(std::size_t self);
+    void work(std::size_t self);
+};
+
+// Output formats of Datastructures::metrics_snapshot
+enum class MetricsFormat{ json, prometheus };
+
+// Called by the for_each listings of Datastructures with one id at a time,
+// returning false ends the listing. A station id only lives until visit returns.
+using StationVisitor = std::function<bool(std::string_view)>;
+using RegionVisitor = std::function<bool(RegionID)>;
+
 class Datastructures
 {
 public:
@@ -161,8 +575,9 @@ public:
     // Short rationale for estimate: Copies the data from unordered_map to vector
     std::vector<StationID> all_stations();
 
-    // Estimate of performance: O(logn)
-    // Short rationale for estimate: Adding values to std::map logn time
+    // Estimate of performance: O(log n + b)
+    // Short rationale for estimate: Adding values to std::map logn time, the name index
+    // shifts the entries of one block of at most b
     bool add_station(StationID id, Name const& name, Coord xy);
 
     // Estimate of performance: O(1)
@@ -176,9 +591,21 @@ public:
     // We recommend you implement the operations below only after implementing the ones above
 
     // Estimate of performance: O(n)
-    // Short rationale for estimate: iterating a map is linear
+    // Short rationale for estimate: iterating the sorted name index is linear
     std::vector<StationID> stations_alphabetically();
 
+    // Stations in name order starting at from_name. Pass the name and id of the last
+    // station of the previous page as from_name and after_id to get the next page.
+    // Estimate of performance: O(log n + count)
+    // Short rationale for estimate: binary search over the blocks by their last name, binary
+    // search inside the one block found, then a scan of count entries
+    std::vector<StationID> stations_alphabetically(Name const& from_name, unsigned int count,
+                                                   StationID const& after_id = NO_STATION);
+
+    // Estimate of performance: O(log n + limit)
+    // Short rationale for estimate: binary search for the prefix, then a scan while names match
+    std::vector<StationID> stations_with_prefix(Name const& prefix, unsigned int limit);
+
     // Estimate of performance: O(n)
     // Short rationale for estimate: iterating a map is linear
     std::vector<StationID> stations_distance_increasing();
@@ -187,23 +614,30 @@ public:
     // Short rationale for estimate: find on unordered map runs on logaritmic time
     StationID find_station_with_coord(Coord xy);
 
-    // Estimate of performance: O(logn)
-    // Short rationale for estimate: Finding and ereasing from map takes logaritmic time
+    // Estimate of performance: O(log n + d)
+    // Short rationale for estimate: Finding and ereasing from map takes logaritmic time,
+    // only the weights of the d hops to and from the station are recomputed
     bool change_station_coord(StationID id, Coord newcoord);
 
-    // Estimate of performance: O(1)
-    // Short rationale for estimate: searching in unordered_map is on average constant time complexity
+    // Estimate of performance: O(d)
+    // Short rationale for estimate: binary search for the place in the d sorted departures
+    // of the station, inserting shifts the later ones
     bool add_departure(StationID stationid, TrainID trainid, Time time);
 
-    // Estimate of performance: O(n)
-    // Short rationale for estimate: Iterating the vector takes linear time
+    // Estimate of performance: O(d)
+    // Short rationale for estimate: binary search finds the departures at that time among
+    // the d of the station, erasing from the vector shifts the later ones
     bool remove_departure(StationID stationid, TrainID trainid, Time time);
 
-    // Estimate of performance: O(nlogn)
-    // Short rationale for estimate: std::sort has time complexity of nlogn, where n is
-    //the size of departures
+    // Estimate of performance: O(log d + k)
+    // Short rationale for estimate: binary search in the d sorted departures of the station,
+    // then the k later departures are copied in order
     std::vector<std::pair<Time, TrainID>> station_departures_after(StationID stationid, Time time);
 
+    // Estimate of performance: O(log d + limit)
+    // Short rationale for estimate: same as above but stops after limit departures
+    std::vector<std::pair<Time, TrainID>> station_departures_after(StationID stationid, Time time, unsigned int limit);
+
     // We recommend you implement the operations below only after implementing the ones above
 
     // Estimate of performance: O(1)
@@ -222,97 +656,400 @@ public:
     // Short rationale for estimate: searching in unordered_map is on average constant time complexity
     std::vector<Coord> get_region_coords(RegionID id);
 
-    // Estimate of performance: O(1)
-    // Short rationale for estimate: searching in unordered_map is on average constant time complexity
+    // Estimate of performance: O(h)
+    // Short rationale for estimate: walks the ancestors of parentid to refuse cycles,
+    // the region index is only marked out of date
     bool add_subregion_to_region(RegionID id, RegionID parentid);
 
     // Estimate of performance: O(1)
     // Short rationale for estimate: searching in unordered_map is on average constant time complexity
     bool add_station_to_region(StationID id, RegionID parentid);
 
-    // Estimate of performance: O(n)
-    // Short rationale for estimate: Worst case is O(n) if the tree is unbalanced
+    // Estimate of performance: O(h)
+    // Short rationale for estimate: follows the parent pointers from the region of the
+    // station, h is its depth and reaches the region count only for a chain of regions
     std::vector<RegionID> station_in_regions(StationID id);
 
     // Non-compulsory operations
 
 
-    // Estimate of performance: O(n)
-    // Short rationale for estimate: where n is the number of regions in regions_map
+    // Estimate of performance: O(k)
+    // Short rationale for estimate: the subregions are a contiguous range of the
+    // preorder, k is the number of subregions
     std::vector<RegionID> all_subregions_of_region(RegionID id);
 
-    // Estimate of performance: O(n log k)
-    // Short rationale for estimate: partial_sort has complexity of n log k but
-    // but the function is basically o(n) because K = 3
+    // Estimate of performance: O(1) on average
+    // Short rationale for estimate: Only the grid cells around xy are scanned
+    // until the three closest stations are known
     std::vector<StationID> stations_closest_to(Coord xy);
 
-    // Estimate of performance: O(log n)
-    // Short rationale for estimate: ereasing from map is logaritmic
+    // Estimate of performance: O(log n + d * L) amortized
+    // Short rationale for estimate: ereasing from map is logaritmic, the d hops and the stops of
+    // the trains through the station (L stops each) are unlinked, compaction is amortized over
+    // the removals that left the tombstones
     bool remove_station(StationID id);
 
-    // Estimate of performance: O(h1 * h2)
-    // Short rationale for estimate: worst case is when two regions are maxium distance away from eachother
+    // Estimate of performance: O(log h)
+    // Short rationale for estimate: binary lifting jumps up the tree in powers of two,
+    // the ancestor checks compare preorder intervals in constant time
     RegionID common_parent_of_regions(RegionID id1, RegionID id2);
     //
     // New assignment 2 operations
     //
 
-    // Estimate of performance: O(n)
-    // Short rationale for estimate: Looping through vector is linear
+    // Estimate of performance: O(s log s + s * d)
+    // Short rationale for estimate: each of the s stops is a sorted insert into the d departures
+    // of its station and the stop index of the train is sorted once, the route graph is only
+    // marked out of date and rebuilt by the next route query
     bool add_train(TrainID trainid, std::vector<std::pair<StationID, Time>> stationtimes);
 
     // Estimate of performance: O(1)
     // Short rationale for estimate: searching from unordered_map is constant
     std::vector<StationID> next_stations_from(StationID id);
 
-    // Estimate of performance: O(n)
-    // Short rationale for estimate: Only loops the vector once
+    // Estimate of performance: O(log s + k)
+    // Short rationale for estimate: binary search for the station in the stop index of the train,
+    // then the k stops after it are copied
     std::vector<StationID> train_stations_from(StationID stationid, TrainID trainid);
 
+    // Trains stopping at the station in the order they were first seen, NO_TRAIN if the station does not exist
+    // Estimate of performance: O(d)
+    // Short rationale for estimate: one pass over the stops made at the station, those of one train are adjacent
+    std::vector<TrainID> trains_through_station(StationID id);
+
     // Estimate of performance: O(n)
     // Short rationale for estimate: For-looping through vector
     void clear_trains();
 
-    // Estimate of performance: O(V2)
-    // Short rationale for estimate: using modified bfs algorithm that calculates the shortest route
+    // Estimate of performance: O(V + E)
+    // Short rationale for estimate: bfs on the graph snapshot, search state is reused between queries
     std::vector<std::pair<StationID, Distance>> route_any(StationID fromid, StationID toid);
 
     // Non-compulsory operations
 
-    // Estimate of performance: O(V2)
-    // Short rationale for estimate: Using modified bfs algorithm that calculates the shortest route
+    // Estimate of performance: O(V + E)
+    // Short rationale for estimate: Same bfs as route_any, which finds the route with least stations
     std::vector<std::pair<StationID, Distance>> route_least_stations(StationID fromid, StationID toid);
 
     // Estimate of performance: O(V + E)
     // Short rationale for estimate: Using BFS to find a route with cycle
     std::vector<StationID> route_with_cycle(StationID fromid);
 
-    // Estimate of performance: O(V2)
-    // Short rationale for estimate: Using djikstra like algorithm to find the shortest distance from a to b
+    // Estimate of performance: O((V + E) log V)
+    // Short rationale for estimate: A* search with a binary heap, in practice only the stations
+    // inside the ellipse around the straight line from a to b get settled
     std::vector<std::pair<StationID, Distance>> route_shortest_distance(StationID fromid, StationID toid);
 
+    //
+    // Additional operations
+    //
+
+    // Estimate of performance: O(k log k) on average
+    // Short rationale for estimate: grid cells are scanned in rings around xy and the
+    // search stops once no unscanned cell can hold anything closer than the k:th hit
+    std::vector<StationID> stations_nearest(Coord xy, unsigned int k);
+
+    // Estimate of performance: O(m log m) on average, m = stations in the radius
+    // Short rationale for estimate: only the grid cells overlapping the circle are scanned,
+    // the hits are sorted by distance
+    std::vector<StationID> stations_within_radius(Coord xy, Distance radius);
+
+    // Estimate of performance: O(log C + C)
+    // Short rationale for estimate: connection scan, binary search to the first connection
+    // leaving at departure_time and one linear sweep over the rest of the sorted connections
+    std::vector<std::tuple<StationID, TrainID, Time>> route_earliest_arrival(StationID fromid, StationID toid, Time departure_time);
+
+    // Estimate of performance: O(K * (R + S))
+    // Short rationale for estimate: RAPTOR does at most K = max_transfers + 1 rounds and each
+    // round scans every route pattern R through a station improved in the previous round once,
+    // S = total stops of those patterns. Labels are kept only for improved stations and the
+    // per station state is stamped, so nothing is proportional to the station count.
+    std::vector<std::vector<std::tuple<StationID, TrainID, Time>>> route_pareto(StationID fromid, StationID toid, Time departure_time, unsigned int max_transfers);
+
+    // Estimate of performance: O(1)
+    // Short rationale for estimate: compares the preorder intervals of the two regions
+    bool is_subregion_of(RegionID id, RegionID parentid);
+
+    // Estimate of performance: O(log R + k * p)
+    // Short rationale for estimate: R-tree descent to the k regions whose bounding box holds
+    // xy, then a point in polygon test over their p vertices
+    std::vector<RegionID> regions_containing(Coord xy);
+
+    // Estimate of performance: O(n * (log R + k * p))
+    // Short rationale for estimate: one regions_containing lookup per station
+    unsigned int assign_stations_to_regions_by_geometry();
+
+    // Estimate of performance: O(k log k + k log n)
+    // Short rationale for estimate: hash tables are presized once, the new stations are sorted
+    // once for the name index and once for the coordinate map, then inserted in order
+    unsigned int add_stations_bulk(std::vector<std::tuple<StationID, Name, Coord>> new_stations);
+
+    // Estimate of performance: O(k)
+    // Short rationale for estimate: regions_map is presized once and the region indexes
+    // are rebuilt once by the next query that needs them
+    unsigned int add_regions_bulk(std::vector<std::tuple<RegionID, Name, std::vector<Coord>>> new_regions);
+
+    // Estimate of performance: O(s + d log d)
+    // Short rationale for estimate: s = stops of the new trains, adjacency is presized and filled
+    // in one pass, new departures are sorted per station and merged with the old ones
+    unsigned int add_trains_bulk(std::vector<std::pair<TrainID, std::vector<std::pair<StationID, Time>>>> new_trains);
+
+    // Estimate of performance: O(n + E + D + S + R)
+    // Short rationale for estimate: every table is written once as a flat array
+    bool save_snapshot(std::string const& path);
+
+    // Estimate of performance: O(n + E + D + S + R)
+    // Short rationale for estimate: the file is mapped and every array is copied into place once,
+    // only the hash tables and ordered indexes are built, the route graph is used as stored
+    bool load_snapshot(std::string const& path);
+
+    // Listings without copies. The ids are handed to visit straight from the internal
+    // storage in the order given for each listing, skipping the first offset
+    // and stopping after limit of them or once visit returns false. They return the
+    // number of ids visited. The Datastructures must not be changed during a listing.
+
+    // The order is unspecified, but the same for every call while nothing changes, so
+    // consecutive offsets page through all stations
+    // Estimate of performance: O(offset + k)
+    // Short rationale for estimate: one pass over the dense station array, removed stations are skipped
+    std::size_t for_each_station(StationVisitor const& visit, std::size_t offset = 0,
+                                 std::size_t limit = std::numeric_limits<std::size_t>::max());
+
+    // In the order of stations_alphabetically
+    // Estimate of performance: O(offset / b + k)
+    // Short rationale for estimate: whole blocks of b name index entries are skipped by their size
+    std::size_t for_each_station_alphabetically(StationVisitor const& visit, std::size_t offset = 0,
+                                                std::size_t limit = std::numeric_limits<std::size_t>::max());
+
+    // In the order of stations_distance_increasing
+    // Estimate of performance: O(offset + k)
+    // Short rationale for estimate: in order walk of the coordinate map
+    std::size_t for_each_station_by_distance(StationVisitor const& visit, std::size_t offset = 0,
+                                             std::size_t limit = std::numeric_limits<std::size_t>::max());
+
+    // In the order of all_regions
+    // Estimate of performance: O(offset + k)
+    // Short rationale for estimate: walk of the region hash table
+    std::size_t for_each_region(RegionVisitor const& visit, std::size_t offset = 0,
+                                std::size_t limit = std::numeric_limits<std::size_t>::max());
+
+    // In the order of next_stations_from, visits nothing when the station does not exist
+    // Estimate of performance: O(offset + k)
+    // Short rationale for estimate: walk of the adjacency of one station
+    std::size_t for_each_next_station(StationID const& id, StationVisitor const& visit, std::size_t offset = 0,
+                                      std::size_t limit = std::numeric_limits<std::size_t>::max());
+
+    // Concurrent reads. The Datastructures itself belongs to one writer thread,
+    // which calls publish() after a batch of changes. pin() may be called from
+    // any thread and the returned view stays valid and unchanged for as long
+    // as the caller holds it.
+
+    // Estimate of performance: O(1)
+    // Short rationale for estimate: atomic load of the published pointer
+    std::shared_ptr<const NetworkView> pin() const;
+
+    // Estimate of performance: O(n + T + p * DEPARTURE_PAGE) when everything changed
+    // Short rationale for estimate: only the station table, train ids and departure pages
+    // that changed since the last publish are copied, the rest is shared
+    std::uint64_t publish();
+
+    // Streaming text ingest. One record per line, fields separated by commas, blank lines and
+    // lines starting with '#' are skipped, malformed records and duplicate ids are skipped.
+    //   stations:   id,name,x,y
+    //   departures: stationid,trainid,time
+    //   trains:     trainid,stationid,time[,stationid,time...]
+
+    // Estimate of performance: O(k log k + k log n)
+    // Short rationale for estimate: input is read in fixed size chunks and split in place,
+    // each chunk of new stations is indexed like add_stations_bulk
+    unsigned int ingest_stations(std::istream& input);
+
+    // Estimate of performance: O(k * d)
+    // Short rationale for estimate: one sorted insert into the departures of the station per record
+    unsigned int ingest_departures(std::istream& input);
+
+    // Estimate of performance: O(s + d log d)
+    // Short rationale for estimate: stops are resolved straight from the chunk, each chunk of
+    // trains is linked like add_trains_bulk
+    unsigned int ingest_trains(std::istream& input);
+
+    // Batch queries, answered in parallel and returned in input order. Each
+    // worker thread searches with its own workspace on the shared snapshot.
+
+    // Estimate of performance: O(q * (V + E) log V / p)
+    // Short rationale for estimate: q independent route searches spread over p threads,
+    // route_least_stations when fewest_stations is set, otherwise route_shortest_distance
+    std::vector<std::vector<std::pair<StationID, Distance>>> route_many(std::vector<std::pair<StationID, StationID>> const& queries,
+                                                                        bool fewest_stations = false);
+
+    // Estimate of performance: O(q * k / p) on average
+    // Short rationale for estimate: q independent grid lookups spread over p threads
+    std::vector<std::vector<StationID>> closest_many(std::vector<Coord> const& coords, unsigned int k = 3);
+
+    // Synthetic network for benchmarks, the same seed and size always give the same network.
+    // Stations S0 .. S<n-1> are spread evenly over a square, regions 1 .. max(1, n/100) form a
+    // 4-ary tree where children split their parent into quadrants. Lines 0 .. max(1, n/4)-1
+    // are feeders of 4-12 neighbouring stops ending at a hub station, the rest are trunks
+    // joining the hubs along grid rows and columns. Line l is run out by trains T<l>_0 and
+    // T<l>_1 and back by T<l>_2 and T<l>_3. Everything already stored is cleared first.
+
+    // Estimate of performance: O(n log n)
+    // Short rationale for estimate: everything goes through the bulk loaders, each line
+    // picks its stops with nearest neighbour queries
+    void generate_network(unsigned int seed, unsigned int station_count);
+
+    // Operation metrics, compiled in with DATASTRUCTURES_METRICS and free otherwise. Every
+    // public operation counts its calls and latency into a log2 histogram, route searches also
+    // count the stations (connections for route_earliest_arrival) they expand. Operations
+    // built from other public operations count those too. Counters are kept per thread and
+    // summed over all threads, including finished ones, when a snapshot is taken.
+
+    // Estimate of performance: O(t * m)
+    // Short rationale for estimate: the counters of t threads are summed for each of m operations
+    static std::string metrics_snapshot(MetricsFormat format = MetricsFormat::json);
+
 
 private:
     // Add stuff needed for your class implementation here
-    
-    std::vector<std::pair<TrainID, Time>> departures_vec;
-    std::unordered_map<RegionID, Region> regions_map;
-    std::vector<StationID> neighbours;
-    std::unordered_map<StationID, Station> stations_map;
-    std::map<Coord, StationID, CoordComparator> coord_map;
-    std::map<Name, StationID> stations_sorted;
-    std::unordered_map<TrainID, Train> train_map;
 
-    int distance_between(StationID fromid, StationID toid){
+    // Names, timetables, neighbour lists and region polygons come from this
+    // pool, which takes its memory from the arena in growing chunks. Freed
+    // blocks are reused by the pool and clear_all hands the whole arena back
+    // at once. Declared first so it outlives everything allocated from it.
+    std::pmr::monotonic_buffer_resource entity_arena;
+    std::pmr::unsynchronized_pool_resource entity_memory{&entity_arena};
+
+    // Stations and trains live in dense vectors, the lookup maps intern the
+    // string IDs once so the rest of the class can work on indices
+    std::vector<Station> stations;
+    StationColumns station_columns;
+    std::unordered_map<StationID, StationIndex> station_lookup;
+    std::vector<Train> trains;
+    std::vector<TrainID> train_ids;
+    std::unordered_map<TrainID, TrainIndex> train_lookup;
+
+    RegionMap regions_map{&entity_memory};
+    RegionForest region_forest;
+    // Region intervals and lifting tables are rebuilt when the hierarchy changed
+    bool region_forest_valid = false;
+
+    RegionRTree region_tree;
+    bool region_tree_valid = false;
+
+    void index_stations(std::vector<StationIndex> added);
+    void add_train_stops(TrainID const& trainid, std::vector<std::pair<StationIndex, Time>> stops);
+    void link_trains(std::vector<TrainIndex> const& added);
+
+    const RegionForest& regions_indexed();
+    const RegionRTree& regions_spatial();
+    std::map<Coord, StationIndex, CoordComparator> coord_map;
+    NameIndex stations_sorted{stations};
+    SpatialGrid station_grid;
+
+    // Smallest weight / length ratio of the edges added so far, see Graph::heuristic_scale
+    double heuristic_scale = 1.0;
+
+    // Lazily rebuilt after the network changes, nullptr means out of date.
+    // Edge weights are patched in place while no published view shares it.
+    std::shared_ptr<Graph> graph_snapshot;
+    // Every train hop sorted by departure time, rebuilt like the graph
+    std::shared_ptr<const std::vector<Connection>> connection_snapshot;
+    std::shared_ptr<const RoutePatterns> pattern_snapshot;
+
+    const Graph& graph();
+    const std::vector<Connection>& connections();
+    const RoutePatterns& patterns();
+
+    void invalidate_network(){
+        graph_snapshot.reset();
+        connection_snapshot.reset();
+        pattern_snapshot.reset();
+    }
+
+    // Latest published view, read and replaced with the atomic shared_ptr functions
+    std::shared_ptr<const NetworkView> published;
+    // What changed since the last publish
+    bool stations_changed = true;
+    bool everything_changed = true;
+    std::vector<char> departure_pages_changed;
 
-        int x1 = stations_map[fromid].coord.x;
-        int y1 = stations_map[fromid].coord.y;
-        int x2 = stations_map[toid].coord.x;
-        int y2 = stations_map[toid].coord.y;
+    // Created by the first batch query
+    std::unique_ptr<WorkPool> pool;
+    WorkPool& work_pool();
 
-        return std::sqrt(std::pow(x1-x2, 2) + std::pow(y1-y2, 2));
- }
+    std::vector<std::pair<StationID, Distance>> route_on(Graph const& g, StationID const& fromid, StationID const& toid,
+                                                         bool fewest_stations) const;
 
+    void departures_changed(StationIndex v){
+        std::size_t page = v / NetworkView::DEPARTURE_PAGE;
+        if(departure_pages_changed.size() <= page){departure_pages_changed.resize(page + 1, 0);}
+        departure_pages_changed[page] = 1;
+    }
+
+    StationIndex find_station(StationID const& id) const{
+        auto it = station_lookup.find(id);
+        if(it == station_lookup.end()){return NO_INDEX;}
+        return it->second;
+    }
+
+    TrainIndex find_train(TrainID const& id) const{
+        auto it = train_lookup.find(id);
+        if(it == train_lookup.end()){return NO_INDEX;}
+        return it->second;
+    }
+
+    TrainIndex intern_train(TrainID const& id){
+        auto it = train_lookup.find(id);
+        if(it != train_lookup.end()){return it->second;}
+        TrainIndex index = static_cast<TrainIndex>(train_ids.size());
+        train_lookup.emplace(id, index);
+        train_ids.push_back(id);
+        trains.push_back(new_train());
+        return index;
+    }
+
+    void insert_departure(StationIndex stationid, TrainIndex trainid, Time time){
+        auto& departures = stations[stationid].departures;
+        auto at = std::upper_bound(departures.begin(), departures.end(), time,
+                                   [](Time t, std::pair<Time, TrainIndex> const& d){ return t < d.first; });
+        departures.insert(at, std::make_pair(time, trainid));
+        departures_changed(stationid);
+    }
+
+    int distance_between(StationIndex fromid, StationIndex toid);
+    void add_edge(StationIndex fromid, StationIndex toid);
+    void remove_edge(StationIndex fromid, StationIndex toid);
+    void update_edge_weights(StationIndex v);
+
+    // Removed stations stay as tombstones until they outnumber the live ones
+    // and there are at least COMPACT_AFTER of them, then the slots are
+    // compacted and every index renumbered
+    static constexpr StationIndex COMPACT_AFTER = 64;
+    StationIndex removed_count = 0;
+    void unlink_station(StationIndex v);
+    void index_train_stops(TrainIndex train);
+    void unindex_train_stops(TrainIndex train);
+    void compact_stations();
+
+    void append_station(StationID id, std::string_view name, Coord coord){
+        stations.push_back(Station{std::move(id), std::pmr::string(name, &entity_memory),
+                                   std::pmr::vector<std::pair<Time, TrainIndex>>(&entity_memory),
+                                   std::pmr::vector<StationIndex>(&entity_memory),
+                                   std::pmr::vector<Distance>(&entity_memory),
+                                   std::pmr::vector<StationIndex>(&entity_memory),
+                                   std::pmr::vector<std::pair<TrainIndex, std::uint32_t>>(&entity_memory)});
+        station_columns.push_back(coord);
+    }
+
+    Train new_train(){
+        return Train{std::pmr::vector<std::pair<StationIndex, Time>>(&entity_memory),
+                     std::pmr::vector<std::pair<StationIndex, std::uint32_t>>(&entity_memory)};
+    }
+
+    Region new_region(RegionID id, std::string_view name, std::vector<Coord> const& coords){
+        return Region{std::pmr::string(name, &entity_memory), std::pmr::vector<Coord>(coords.begin(), coords.end(), &entity_memory),
+                      id, nullptr, std::pmr::vector<Region*>(&entity_memory)};
+    }
 
 };
 
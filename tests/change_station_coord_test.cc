@@ -0,0 +1,46 @@
+// Checks that a station moved onto a coordinate another station already has is
+// the one found there afterwards, like a station added there, and that the
+// station it displaced still moves and is found at its new place.
+
+#include "datastructures.hh"
+
+#include <iostream>
+
+int main()
+{
+    int failures = 0;
+    auto expect = [&](StationID const& got, StationID const& want, char const* what){
+        if(got != want){
+            std::cerr << what << ": got " << got << ", expected " << want << std::endl;
+            ++failures;
+        }
+    };
+
+    Datastructures ds;
+    ds.add_station("A", "Alpha", {0, 0});
+    ds.add_station("B", "Bravo", {5, 5});
+
+    if(!ds.change_station_coord("B", {0, 0})){
+        std::cerr << "moving B onto A failed" << std::endl;
+        ++failures;
+    }
+    expect(ds.find_station_with_coord({0, 0}), "B", "moved onto an occupied coordinate");
+    expect(ds.find_station_with_coord({5, 5}), NO_STATION, "old coordinate of B");
+
+    // A lost its coordinate entry to B but still moves
+    if(!ds.change_station_coord("A", {7, 7})){
+        std::cerr << "moving the displaced A failed" << std::endl;
+        ++failures;
+    }
+    expect(ds.find_station_with_coord({7, 7}), "A", "displaced station moved away");
+    expect(ds.find_station_with_coord({0, 0}), "B", "coordinate left by the displaced station");
+
+    // Adding and moving resolve a shared coordinate the same way
+    ds.add_station("C", "Charlie", {7, 7});
+    expect(ds.find_station_with_coord({7, 7}), "C", "added onto an occupied coordinate");
+    ds.change_station_coord("A", {0, 0});
+    expect(ds.find_station_with_coord({0, 0}), "A", "moved back onto an occupied coordinate");
+    expect(ds.find_station_with_coord({7, 7}), "C", "coordinate left by the moved station");
+
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,181 @@
+// Checks that removing more than half of the stations, which compacts the station
+// table, keeps every lookup, listing and train query in line with a simple model
+// of the stations that are left, and that routes still follow the trains.
+
+#include "datastructures.hh"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <map>
+#include <queue>
+#include <random>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace
+{
+int failures = 0;
+
+void expect(bool ok, std::string const& what)
+{
+    if(!ok){
+        std::cerr << what << std::endl;
+        ++failures;
+    }
+}
+
+StationID station(int i){ return "S" + std::to_string(i); }
+}
+
+int main()
+{
+    std::mt19937 random(2024);
+    Datastructures ds;
+    const int n = 400;
+    std::map<int, Coord> coords;
+    for(int i = 0; i < n; ++i){
+        Coord xy{static_cast<int>(random() % 100000), static_cast<int>(random() % 100000)};
+        // The coordinate index keeps one station per coordinate
+        while(std::any_of(coords.begin(), coords.end(), [&](auto const& c){ return c.second == xy; })){++xy.x;}
+        ds.add_station(station(i), "Name" + std::to_string(i % 31), xy);
+        coords[i] = xy;
+    }
+    std::map<TrainID, std::vector<int>> trains;
+    for(int t = 0; t < 120; ++t){
+        std::vector<int> stops;
+        std::vector<std::pair<StationID, Time>> times;
+        while(stops.size() < 2 + random() % 10){
+            int s = static_cast<int>(random() % n);
+            if(std::find(stops.begin(), stops.end(), s) != stops.end()){continue;}
+            times.emplace_back(station(s), static_cast<Time>(600 + 10 * stops.size()));
+            stops.push_back(s);
+        }
+        TrainID id = "T" + std::to_string(t);
+        expect(ds.add_train(id, times), "add_train " + id + " failed");
+        trains[id] = stops;
+    }
+    // Build the route graph before removing so removal has to patch it
+    ds.route_least_stations(station(0), station(1));
+
+    // Remove more than half and more than COMPACT_AFTER stations, checking lookups on the way
+    std::vector<int> order(n);
+    for(int i = 0; i < n; ++i){order[i] = i;}
+    std::shuffle(order.begin(), order.end(), random);
+    std::set<int> removed(order.begin(), order.begin() + 3 * n / 4);
+    for(int s : removed){
+        expect(ds.remove_station(station(s)), "remove_station " + station(s) + " failed");
+        expect(!ds.remove_station(station(s)), "removed " + station(s) + " twice");
+        expect(ds.get_station_name(station(s)) == NO_NAME, "removed " + station(s) + " still has a name");
+    }
+    std::vector<int> alive;
+    for(int i = 0; i < n; ++i){
+        if(!removed.count(i)){alive.push_back(i);}
+    }
+
+    // Stations left
+    expect(ds.station_count() == alive.size(), "station_count is wrong after compaction");
+    std::vector<StationID> all = ds.all_stations();
+    std::sort(all.begin(), all.end());
+    std::vector<StationID> want_all;
+    for(int s : alive){want_all.push_back(station(s));}
+    std::sort(want_all.begin(), want_all.end());
+    expect(all == want_all, "all_stations does not list exactly the stations left");
+    for(int s : alive){
+        expect(ds.get_station_name(station(s)) == "Name" + std::to_string(s % 31), "name of " + station(s) + " is wrong");
+        expect(ds.get_station_coordinates(station(s)) == coords[s], "coordinates of " + station(s) + " are wrong");
+        expect(ds.find_station_with_coord(coords[s]) == station(s), "coordinate of " + station(s) + " finds another station");
+    }
+    for(int s : removed){
+        expect(ds.find_station_with_coord(coords[s]) == NO_STATION, "coordinate of removed " + station(s) + " still found");
+    }
+    auto alphabetical = ds.stations_alphabetically();
+    expect(alphabetical.size() == alive.size(), "stations_alphabetically has the wrong size");
+    for(std::size_t i = 1; i < alphabetical.size(); ++i){
+        auto a = std::make_pair(ds.get_station_name(alphabetical[i - 1]), alphabetical[i - 1]);
+        auto b = std::make_pair(ds.get_station_name(alphabetical[i]), alphabetical[i]);
+        expect(a < b, "stations_alphabetically is out of order at " + b.second);
+    }
+    auto by_distance = ds.stations_distance_increasing();
+    expect(by_distance.size() == alive.size(), "stations_distance_increasing has the wrong size");
+
+    // Trains keep their stops in order with the removed ones bridged over
+    std::map<int, std::multiset<int>> edges;
+    std::map<int, std::vector<TrainID>> through;
+    for(auto const& train : trains){
+        std::vector<int> stops;
+        for(int s : train.second){
+            if(!removed.count(s)){stops.push_back(s);}
+        }
+        for(std::size_t i = 0; i < stops.size(); ++i){
+            through[stops[i]].push_back(train.first);
+            if(i + 1 < stops.size()){edges[stops[i]].insert(stops[i + 1]);}
+            std::vector<StationID> after;
+            for(std::size_t j = i + 1; j < stops.size(); ++j){after.push_back(station(stops[j]));}
+            if(after.empty()){after.push_back(NO_STATION);}
+            expect(ds.train_stations_from(station(stops[i]), train.first) == after,
+                   "train_stations_from " + station(stops[i]) + " on " + train.first + " is wrong");
+        }
+    }
+    for(int s : alive){
+        std::multiset<int> next;
+        for(auto const& id : ds.next_stations_from(station(s))){next.insert(std::stoi(id.substr(1)));}
+        expect(next == edges[s], "next_stations_from " + station(s) + " is wrong");
+        auto trains_here = ds.trains_through_station(station(s));
+        std::sort(trains_here.begin(), trains_here.end());
+        std::sort(through[s].begin(), through[s].end());
+        expect(trains_here == through[s], "trains_through_station " + station(s) + " is wrong");
+    }
+
+    // Routes against a breadth first search and Bellman-Ford on the model
+    for(int round = 0; round < 10; ++round){
+        int from = alive[random() % alive.size()];
+        std::map<int, int> hops{{from, 0}};
+        std::queue<int> queue;
+        queue.push(from);
+        while(!queue.empty()){
+            int u = queue.front();
+            queue.pop();
+            for(int v : edges[u]){
+                if(hops.emplace(v, hops[u] + 1).second){queue.push(v);}
+            }
+        }
+        std::map<int, Distance> distance{{from, 0}};
+        for(std::size_t pass = 0; pass < alive.size(); ++pass){
+            for(auto const& reached : std::map<int, Distance>(distance)){
+                for(int v : edges[reached.first]){
+                    double dx = double(coords[reached.first].x) - coords[v].x;
+                    double dy = double(coords[reached.first].y) - coords[v].y;
+                    Distance d = reached.second + static_cast<Distance>(std::sqrt(dx * dx + dy * dy));
+                    if(!distance.count(v) || d < distance[v]){distance[v] = d;}
+                }
+            }
+        }
+        for(int to : alive){
+            auto least = ds.route_least_stations(station(from), station(to));
+            auto shortest = ds.route_shortest_distance(station(from), station(to));
+            if(!hops.count(to)){
+                expect(least.empty() && shortest.empty(), "route to unreachable " + station(to));
+                continue;
+            }
+            expect(least.size() == std::size_t(hops[to]) + 1, "route_least_stations to " + station(to) + " is not shortest");
+            expect(!shortest.empty() && shortest.back().second == distance[to],
+                   "route_shortest_distance to " + station(to) + " is not shortest");
+            for(std::size_t i = 1; i < least.size(); ++i){
+                int u = std::stoi(least[i - 1].first.substr(1));
+                int v = std::stoi(least[i].first.substr(1));
+                expect(edges[u].count(v) > 0, "route_least_stations uses a missing hop to " + station(v));
+            }
+        }
+    }
+
+    // New stations after compaction get fresh slots and are found
+    expect(ds.add_station("new", "New", {-5, -5}), "add_station after compaction failed");
+    expect(!ds.add_station(station(alive.front()), "Again", {-6, -6}), "added a station that is still there");
+    expect(ds.add_station(station(*removed.begin()), "Back", {-7, -7}), "could not re-add a removed station");
+    expect(ds.find_station_with_coord({-7, -7}) == station(*removed.begin()), "re-added station not found");
+    expect(ds.station_count() == alive.size() + 2, "station_count is wrong after adding again");
+
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,131 @@
+// Checks that paging through the stations in name order with stations_alphabetically,
+// stations_with_prefix and for_each_station_alphabetically gives the full listing in
+// (name, id) order after the name index has split its blocks many times, also with
+// many stations sharing one name and after stations were removed.
+
+#include "datastructures.hh"
+
+#include <algorithm>
+#include <iostream>
+#include <random>
+#include <string>
+#include <tuple>
+#include <vector>
+
+namespace
+{
+int failures = 0;
+
+void expect(bool ok, char const* what)
+{
+    if(!ok){
+        std::cerr << what << std::endl;
+        ++failures;
+    }
+}
+
+// Pages of size count through stations_alphabetically, each page starting after
+// the last station of the previous one
+std::vector<StationID> paged(Datastructures& ds, unsigned int count)
+{
+    std::vector<StationID> all;
+    Name from;
+    StationID after = NO_STATION;
+    while(true){
+        auto page = ds.stations_alphabetically(from, count, after);
+        if(page.size() > count){
+            std::cerr << "page of " << page.size() << " ids for count " << count << std::endl;
+            ++failures;
+            break;
+        }
+        all.insert(all.end(), page.begin(), page.end());
+        if(page.size() < count){break;}
+        after = page.back();
+        from = ds.get_station_name(after);
+    }
+    return all;
+}
+
+void check_listings(Datastructures& ds, std::vector<std::pair<Name, StationID>> expected, char const* when)
+{
+    std::sort(expected.begin(), expected.end());
+    std::vector<StationID> ids;
+    for(auto const& station : expected){ids.push_back(station.second);}
+
+    if(ds.stations_alphabetically() != ids){
+        std::cerr << when << ": stations_alphabetically is not in (name, id) order" << std::endl;
+        ++failures;
+    }
+    for(unsigned int count : {1u, 7u, 128u, 129u, 300u}){
+        if(paged(ds, count) != ids){
+            std::cerr << when << ": pages of " << count << " differ from the full listing" << std::endl;
+            ++failures;
+        }
+    }
+
+    // Offsets into the block list, on both sides of the block boundaries
+    for(std::size_t offset : {std::size_t(0), std::size_t(1), std::size_t(127), std::size_t(128),
+                              std::size_t(255), std::size_t(256), std::size_t(257), ids.size() - 1, ids.size()}){
+        std::vector<StationID> visited;
+        std::size_t count = ds.for_each_station_alphabetically([&](std::string_view id){
+            visited.emplace_back(id);
+            return true;
+        }, offset, 50);
+        std::vector<StationID> want(ids.begin() + std::min(offset, ids.size()),
+                                    ids.begin() + std::min(offset + 50, ids.size()));
+        if(visited != want || count != want.size()){
+            std::cerr << when << ": for_each_station_alphabetically from offset " << offset << " is wrong" << std::endl;
+            ++failures;
+        }
+    }
+
+    // A prefix matching a run of names that spans several blocks
+    std::vector<StationID> prefixed;
+    for(auto const& station : expected){
+        if(station.first.compare(0, 4, "Same") == 0){prefixed.push_back(station.second);}
+    }
+    expect(ds.stations_with_prefix("Same", prefixed.size() + 10) == prefixed, "stations_with_prefix lost a station");
+    prefixed.resize(std::min<std::size_t>(prefixed.size(), 200));
+    expect(ds.stations_with_prefix("Same", 200) == prefixed, "stations_with_prefix ignored its limit");
+}
+}
+
+int main()
+{
+    std::mt19937 random(12345);
+    Datastructures ds;
+    std::vector<std::pair<Name, StationID>> expected;
+
+    // Added one at a time in random order so blocks split in the middle as well as at the end
+    std::vector<int> order(1500);
+    for(std::size_t i = 0; i < order.size(); ++i){order[i] = static_cast<int>(i);}
+    std::shuffle(order.begin(), order.end(), random);
+    for(int i : order){
+        // Every third station shares one name, so a run of equal names spans several blocks
+        Name name = i % 3 == 0 ? "Same" : "Name" + std::to_string(i % 97);
+        StationID id = "s" + std::to_string(i);
+        expect(ds.add_station(id, name, {i, -i}), "add_station failed");
+        expected.emplace_back(name, id);
+    }
+    check_listings(ds, expected, "after adding one at a time");
+
+    // A batch large enough to be merged into the blocks at once
+    std::vector<std::tuple<StationID, Name, Coord>> batch;
+    for(int i = 1500; i < 3000; ++i){
+        Name name = i % 2 == 0 ? "Same" : "Bulk" + std::to_string(i % 13);
+        batch.emplace_back("s" + std::to_string(i), name, Coord{i, -i});
+        expected.emplace_back(name, "s" + std::to_string(i));
+    }
+    expect(ds.add_stations_bulk(batch) == batch.size(), "add_stations_bulk did not add every station");
+    check_listings(ds, expected, "after a bulk insert");
+
+    // Removing a few leaves the blocks uneven without compacting the stations
+    std::shuffle(expected.begin(), expected.end(), random);
+    for(int i = 0; i < 40; ++i){
+        expect(ds.remove_station(expected.back().second), "remove_station failed");
+        expected.pop_back();
+    }
+    check_listings(ds, expected, "after removing stations");
+
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,30 @@
+// Checks that route_pareto handles the largest transfer cap like any other cap
+// that allows every transfer the network offers.
+
+#include "datastructures.hh"
+
+#include <climits>
+#include <iostream>
+
+int main()
+{
+    Datastructures ds;
+    ds.add_station("A", "Alpha", {0, 0});
+    ds.add_station("B", "Bravo", {10, 0});
+    ds.add_station("C", "Charlie", {20, 0});
+    ds.add_train("T1", {{"A", 10}, {"B", 20}});
+    ds.add_train("T2", {{"B", 30}, {"C", 40}});
+
+    auto capped = ds.route_pareto("A", "C", 0, 3);
+    auto unlimited = ds.route_pareto("A", "C", 0, UINT_MAX);
+    if(capped.empty()){
+        std::cerr << "no journey with max_transfers = 3" << std::endl;
+        return 1;
+    }
+    if(unlimited != capped){
+        std::cerr << "max_transfers = UINT_MAX gave " << unlimited.size() << " journeys, expected "
+                  << capped.size() << std::endl;
+        return 1;
+    }
+    return 0;
+}
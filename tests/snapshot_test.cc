@@ -0,0 +1,201 @@
+// Checks that a network saved with save_snapshot loads back with the same answers
+// to every query, and that load_snapshot rejects truncated and corrupted files
+// instead of loading them.
+
+#include "datastructures.hh"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+namespace
+{
+int failures = 0;
+
+void expect(bool ok, std::string const& what)
+{
+    if(!ok){
+        std::cerr << what << std::endl;
+        ++failures;
+    }
+}
+
+// Layout of the header written by save_snapshot: magic, version, section count,
+// then the offset and the size of each section
+const std::size_t VERSION_AT = 8;
+const std::size_t SECTIONS = 23;
+const std::size_t OFFSETS_AT = 16;
+const std::size_t SIZES_AT = OFFSETS_AT + 8 * SECTIONS;
+const std::size_t HEADER_SIZE = SIZES_AT + 8 * SECTIONS;
+// Sections in the order of the header
+const std::size_t STATION_ID_OFFSETS = 1;
+const std::size_t STATION_REGION = 5;
+const std::size_t GRAPH_OFFSETS = 6;
+const std::size_t GRAPH_TARGETS = 7;
+
+std::vector<char> read_file(std::string const& path)
+{
+    std::ifstream in(path, std::ios::binary);
+    return std::vector<char>(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+}
+
+void write_file(std::string const& path, std::vector<char> const& bytes)
+{
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    out.write(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+}
+
+template <typename T>
+T get(std::vector<char> const& bytes, std::size_t at)
+{
+    T value;
+    std::memcpy(&value, bytes.data() + at, sizeof(T));
+    return value;
+}
+
+template <typename T>
+void put(std::vector<char>& bytes, std::size_t at, T value)
+{
+    std::memcpy(bytes.data() + at, &value, sizeof(T));
+}
+
+template <typename T>
+std::vector<T> sorted(std::vector<T> values)
+{
+    std::sort(values.begin(), values.end());
+    return values;
+}
+
+void compare(Datastructures& got, Datastructures& want)
+{
+    expect(got.station_count() == want.station_count(), "station_count differs");
+    auto stations = sorted(want.all_stations());
+    expect(sorted(got.all_stations()) == stations, "all_stations differs");
+    expect(got.stations_alphabetically() == want.stations_alphabetically(), "stations_alphabetically differs");
+    expect(got.stations_distance_increasing() == want.stations_distance_increasing(), "stations_distance_increasing differs");
+    for(auto const& id : stations){
+        expect(got.get_station_name(id) == want.get_station_name(id), "name of " + id + " differs");
+        expect(got.get_station_coordinates(id) == want.get_station_coordinates(id), "coordinates of " + id + " differ");
+        expect(got.find_station_with_coord(want.get_station_coordinates(id)) == want.find_station_with_coord(want.get_station_coordinates(id)),
+               "station at the coordinates of " + id + " differs");
+        expect(sorted(got.next_stations_from(id)) == sorted(want.next_stations_from(id)), "next_stations_from " + id + " differs");
+        expect(got.station_departures_after(id, 0) == want.station_departures_after(id, 0), "departures of " + id + " differ");
+        expect(got.station_in_regions(id) == want.station_in_regions(id), "station_in_regions " + id + " differs");
+        auto trains = want.trains_through_station(id);
+        expect(got.trains_through_station(id) == trains, "trains_through_station " + id + " differs");
+        for(auto const& train : trains){
+            expect(got.train_stations_from(id, train) == want.train_stations_from(id, train),
+                   "train_stations_from " + id + " on " + train + " differs");
+        }
+    }
+
+    auto regions = sorted(want.all_regions());
+    expect(sorted(got.all_regions()) == regions, "all_regions differs");
+    for(RegionID id : regions){
+        expect(got.get_region_name(id) == want.get_region_name(id), "region name differs");
+        expect(got.get_region_coords(id) == want.get_region_coords(id), "region coordinates differ");
+        expect(sorted(got.all_subregions_of_region(id)) == sorted(want.all_subregions_of_region(id)), "subregions differ");
+    }
+
+    for(std::size_t i = 0; i + 1 < stations.size(); i += 7){
+        auto const& from = stations[i];
+        auto const& to = stations[stations.size() - 1 - i];
+        expect(got.route_least_stations(from, to) == want.route_least_stations(from, to), "route_least_stations " + from + " to " + to + " differs");
+        expect(got.route_shortest_distance(from, to) == want.route_shortest_distance(from, to), "route_shortest_distance " + from + " to " + to + " differs");
+        expect(got.route_earliest_arrival(from, to, 100) == want.route_earliest_arrival(from, to, 100), "route_earliest_arrival " + from + " to " + to + " differs");
+    }
+}
+
+// A corrupted file has to be rejected and leave nothing loaded
+void expect_rejected(std::string const& path, std::vector<char> const& bytes, std::string const& what)
+{
+    write_file(path, bytes);
+    Datastructures ds;
+    ds.add_station("old", "Old", {1, 1});
+    expect(!ds.load_snapshot(path), "loaded a snapshot with " + what);
+    expect(ds.station_count() == 0 && ds.all_regions().empty(), "a rejected snapshot with " + what + " left stations or regions behind");
+}
+}
+
+int main()
+{
+    std::string path = "snapshot_test.snap";
+    std::string broken = "snapshot_test_broken.snap";
+
+    Datastructures original;
+    original.generate_network(11, 400);
+    // Removed stations leave holes that must not be saved
+    for(int i = 3; i < 400; i += 17){original.remove_station("S" + std::to_string(i));}
+    original.add_departure("S0", "late", 1000);
+    original.add_station("lonely", "Lonely", {-50, -50});
+
+    expect(original.save_snapshot(path), "save_snapshot failed");
+    Datastructures loaded;
+    loaded.add_station("old", "Old", {1, 1});
+    expect(loaded.load_snapshot(path), "load_snapshot failed on a saved snapshot");
+    expect(loaded.get_station_name("old") == NO_NAME, "loading kept a station from before");
+    compare(loaded, original);
+
+    // The loaded network can be saved again and still changes like a built one
+    expect(loaded.save_snapshot(broken) && read_file(broken) == read_file(path), "saving a loaded snapshot gave another file");
+    expect(loaded.add_station("new", "New", {-60, -60}) && loaded.find_station_with_coord({-60, -60}) == "new",
+           "adding to a loaded network failed");
+
+    std::vector<char> bytes = read_file(path);
+    expect(bytes.size() > HEADER_SIZE, "the snapshot is smaller than its header");
+
+    Datastructures missing;
+    expect(!missing.load_snapshot("snapshot_test_missing.snap"), "loaded a snapshot that does not exist");
+
+    for(std::size_t size : {std::size_t(0), std::size_t(7), HEADER_SIZE - 1, HEADER_SIZE, bytes.size() / 2, bytes.size() - 1}){
+        expect_rejected(broken, std::vector<char>(bytes.begin(), bytes.begin() + size), "only " + std::to_string(size) + " bytes");
+    }
+
+    std::vector<char> corrupted = bytes;
+    corrupted[0] = 'X';
+    expect_rejected(broken, corrupted, "a wrong magic");
+
+    corrupted = bytes;
+    put<std::uint32_t>(corrupted, VERSION_AT, get<std::uint32_t>(bytes, VERSION_AT) + 1);
+    expect_rejected(broken, corrupted, "a newer version");
+
+    corrupted = bytes;
+    put<std::uint64_t>(corrupted, OFFSETS_AT + 8 * GRAPH_TARGETS, bytes.size());
+    expect_rejected(broken, corrupted, "a section starting past the end");
+
+    corrupted = bytes;
+    put<std::uint64_t>(corrupted, SIZES_AT + 8 * GRAPH_TARGETS, get<std::uint64_t>(bytes, SIZES_AT + 8 * GRAPH_TARGETS) - 4);
+    expect_rejected(broken, corrupted, "tables of different lengths");
+
+    // A string offset pointing past the characters
+    corrupted = bytes;
+    std::size_t id_offsets = get<std::uint64_t>(bytes, OFFSETS_AT + 8 * STATION_ID_OFFSETS);
+    put<std::uint32_t>(corrupted, id_offsets + 4, 0xffffffffu);
+    expect_rejected(broken, corrupted, "a string offset out of range");
+
+    // Edge offsets going backwards
+    corrupted = bytes;
+    std::size_t edge_offsets = get<std::uint64_t>(bytes, OFFSETS_AT + 8 * GRAPH_OFFSETS);
+    put<std::uint32_t>(corrupted, edge_offsets + 4, get<std::uint32_t>(bytes, edge_offsets + 8) + 1);
+    expect_rejected(broken, corrupted, "unsorted edge offsets");
+
+    // A station in a region that does not exist
+    corrupted = bytes;
+    put<std::uint32_t>(corrupted, get<std::uint64_t>(bytes, OFFSETS_AT + 8 * STATION_REGION), 0x7fffffffu);
+    expect_rejected(broken, corrupted, "a region index out of range");
+
+    // An edge to a station that does not exist
+    corrupted = bytes;
+    put<std::uint32_t>(corrupted, get<std::uint64_t>(bytes, OFFSETS_AT + 8 * GRAPH_TARGETS), 0x7fffffffu);
+    expect_rejected(broken, corrupted, "an edge target out of range");
+
+    std::remove(path.c_str());
+    std::remove(broken.c_str());
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,69 @@
+// Checks that the scalar and AVX2 squared distance kernels agree with exact
+// 128 bit arithmetic for the extreme int coordinates, and that the closest
+// station queries order such stations correctly.
+
+#include "datastructures.hh"
+
+#include <climits>
+#include <cstdint>
+#include <iostream>
+#include <limits>
+#include <vector>
+
+namespace
+{
+std::uint64_t exact(int x, int y, Coord xy)
+{
+    __int128 dx = __int128(x) - xy.x;
+    __int128 dy = __int128(y) - xy.y;
+    __int128 d = dx * dx + dy * dy;
+    __int128 most = std::numeric_limits<std::uint64_t>::max();
+    return static_cast<std::uint64_t>(d > most ? most : d);
+}
+}
+
+int main()
+{
+    const int values[] = {INT_MIN, INT_MIN + 1, -1, 0, 1, 1518500249, INT_MAX - 1, INT_MAX};
+    std::vector<int> x;
+    std::vector<int> y;
+    for(int a : values){
+        for(int b : values){
+            x.push_back(a);
+            y.push_back(b);
+        }
+    }
+    // An odd count so the AVX2 kernel also runs its scalar tail
+    x.push_back(12345);
+    y.push_back(-678);
+
+    int failures = 0;
+    for(int qx : values){
+        for(int qy : values){
+            Coord xy{qx, qy};
+            std::vector<std::uint64_t> scalar(x.size());
+            std::vector<std::uint64_t> vector(x.size());
+            SpatialGrid::squared_distances(x.data(), y.data(), x.size(), xy, scalar.data(), false);
+            bool has_avx2 = SpatialGrid::squared_distances(x.data(), y.data(), x.size(), xy, vector.data(), true);
+            for(std::size_t i = 0; i < x.size(); ++i){
+                std::uint64_t expected = exact(x[i], y[i], xy);
+                if(scalar[i] != expected || (has_avx2 && vector[i] != expected)){
+                    std::cerr << "(" << x[i] << "," << y[i] << ") from (" << qx << "," << qy << "): scalar "
+                              << scalar[i] << ", avx2 " << vector[i] << ", expected " << expected << std::endl;
+                    ++failures;
+                }
+            }
+        }
+    }
+
+    Datastructures ds;
+    ds.add_station("far", "Far", {INT_MAX, INT_MAX});
+    ds.add_station("near", "Near", {INT_MIN + 10, INT_MIN + 10});
+    ds.add_station("middle", "Middle", {0, 0});
+    auto closest = ds.stations_closest_to({INT_MIN, INT_MIN});
+    if(closest != std::vector<StationID>{"near", "middle", "far"}){
+        std::cerr << "stations_closest_to ordered the extreme stations wrong" << std::endl;
+        ++failures;
+    }
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,116 @@
+// Checks that the queries of a pinned view give the same results as the live
+// Datastructures at the time of publishing, and that a pinned view keeps giving
+// them after the live instance changes and publishes again.
+
+#include "datastructures.hh"
+
+#include <iostream>
+#include <string>
+#include <tuple>
+#include <vector>
+
+namespace
+{
+int failures = 0;
+
+void expect(bool ok, std::string const& what)
+{
+    if(!ok){
+        std::cerr << what << std::endl;
+        ++failures;
+    }
+}
+
+StationID station(unsigned int i){ return "S" + std::to_string(i); }
+
+// What a view has to reproduce for one pair of stations
+struct Answers{
+    std::vector<std::pair<Time, TrainID>> departures;
+    std::vector<std::pair<Time, TrainID>> first_departures;
+    std::vector<std::pair<StationID, Distance>> least;
+    std::vector<std::pair<StationID, Distance>> shortest;
+    std::vector<std::tuple<StationID, TrainID, Time>> earliest;
+};
+
+std::vector<Answers> answers(Datastructures& ds, std::vector<std::pair<StationID, StationID>> const& pairs, Time time)
+{
+    std::vector<Answers> result;
+    for(auto const& pair : pairs){
+        result.push_back({ds.station_departures_after(pair.first, time),
+                          ds.station_departures_after(pair.first, time, 3),
+                          ds.route_least_stations(pair.first, pair.second),
+                          ds.route_shortest_distance(pair.first, pair.second),
+                          ds.route_earliest_arrival(pair.first, pair.second, time)});
+    }
+    return result;
+}
+
+std::vector<Answers> answers(NetworkView const& view, std::vector<std::pair<StationID, StationID>> const& pairs, Time time)
+{
+    std::vector<Answers> result;
+    for(auto const& pair : pairs){
+        result.push_back({view.station_departures_after(pair.first, time),
+                          view.station_departures_after(pair.first, time, 3),
+                          view.route_least_stations(pair.first, pair.second),
+                          view.route_shortest_distance(pair.first, pair.second),
+                          view.route_earliest_arrival(pair.first, pair.second, time)});
+    }
+    return result;
+}
+
+void compare(std::vector<Answers> const& got, std::vector<Answers> const& want,
+             std::vector<std::pair<StationID, StationID>> const& pairs, char const* when)
+{
+    for(std::size_t i = 0; i < pairs.size(); ++i){
+        std::string what = std::string(when) + ": " + pairs[i].first + " to " + pairs[i].second + ", ";
+        expect(got[i].departures == want[i].departures, what + "station_departures_after differs");
+        expect(got[i].first_departures == want[i].first_departures, what + "station_departures_after with a limit differs");
+        expect(got[i].least == want[i].least, what + "route_least_stations differs");
+        expect(got[i].shortest == want[i].shortest, what + "route_shortest_distance differs");
+        expect(got[i].earliest == want[i].earliest, what + "route_earliest_arrival differs");
+    }
+}
+}
+
+int main()
+{
+    const unsigned int n = 300;
+    Datastructures ds;
+    ds.generate_network(7, n);
+
+    std::vector<std::pair<StationID, StationID>> pairs;
+    for(unsigned int i = 0; i < 150; ++i){
+        pairs.emplace_back(station(i * 7 % n), station((i * 13 + 5) % n));
+    }
+    pairs.emplace_back(station(0), "missing");
+    pairs.emplace_back("missing", station(0));
+
+    const Time time = 300;
+    ds.publish();
+    auto view = ds.pin();
+    auto before = answers(ds, pairs, time);
+    compare(answers(*view, pairs, time), before, pairs, "published view");
+    std::size_t routed = 0;
+    for(auto const& answer : before){routed += !answer.earliest.empty();}
+    expect(routed > pairs.size() / 4, "too few trips found for the comparison to mean anything");
+
+    // Change departures, trains and stations on the live instance
+    for(unsigned int i = 0; i < 40; ++i){
+        ds.add_departure(station(i * 7 % n), "extra", static_cast<Time>(time + i));
+    }
+    std::vector<std::pair<StationID, Time>> stops;
+    for(unsigned int i = 0; i < 20; ++i){stops.emplace_back(station(i * 11 % n), static_cast<Time>(time + 5 * i));}
+    ds.add_train("express", stops);
+    for(unsigned int i = 1; i < n; i += 9){ds.remove_station(station(i));}
+    ds.change_station_coord(station(2), {123456, 654321});
+
+    // The pinned view still answers as before, the new one as the live instance
+    compare(answers(*view, pairs, time), before, pairs, "pinned view after changes");
+    ds.publish();
+    auto current = ds.pin();
+    expect(current->version > view->version, "publishing did not make a newer version");
+    compare(answers(*current, pairs, time), answers(ds, pairs, time), pairs, "view published after changes");
+    compare(answers(*view, pairs, time), before, pairs, "pinned view after publishing again");
+
+    return failures == 0 ? 0 : 1;
+}